@@ -0,0 +1,50 @@
+#ifndef _VAULT_CANCEL_HPP_
+#define _VAULT_CANCEL_HPP_
+/**
+ * @file cancel.hpp
+ * @brief Cooperative cancellation of long operations
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/error.hpp>
+
+#include <atomic>
+#include <memory>
+
+namespace vault {
+
+/**
+ * Cancellation token: copies share the same state, so operation
+ * running in one thread can be cancelled from another one. Operation
+ * checks the token between steps and stops unit scripts and other
+ * child processes when it is cancelled.
+ */
+class Cancel
+{
+public:
+    Cancel() : m(std::make_shared<std::atomic<bool> >(false)) {}
+
+    inline void cancel() const { *m = true; }
+    inline void reset() const { *m = false; }
+    inline bool isCancelled() const { return *m; }
+
+    /// the same token (copies share the state)
+    inline bool operator ==(Cancel const &other) const { return m == other.m; }
+
+    /// raises error with "cancelled" reason if it is cancelled
+    inline void check() const
+    {
+        if (isCancelled())
+            qtaround::error::raise({{"msg", "Operation is cancelled"}
+                    , {"reason", "cancelled"}});
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool> > m;
+};
+
+}
+
+#endif // _VAULT_CANCEL_HPP_
@@ -9,6 +9,7 @@
  */
 
 #include <QString>
+#include <QStringList>
 #include <QMap>
 #include <QVariantMap>
 
@@ -45,6 +46,19 @@ public:
 
     QString name() const;
     QString script() const;
+    /// paths (relative to home) unit data are exported from, used to
+    /// detect unchanged units
+    QStringList inputs() const;
+    /// optional command printing the fingerprint of unit data
+    QString fingerprintCommand() const;
+    /// false if unit should be always exported
+    bool isIncremental() const;
+    /// script execution timeout (s), 0 if it is not set
+    int timeout() const;
+    /// units which should be restored before this one
+    QStringList after() const;
+    /// units which should be restored after this one
+    QStringList before() const;
     inline QVariantMap data() const { return m_data; }
 
 private:
@@ -0,0 +1,112 @@
+#ifndef _VAULT_PROGRESS_HPP_
+#define _VAULT_PROGRESS_HPP_
+/**
+ * @file progress.hpp
+ * @brief Structured progress events
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QVariantMap>
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace vault { namespace progress {
+
+enum class Phase {
+    Export, // unit data are copied into the vault by the unit script
+    Import, // unit data are copied from the vault by the unit script
+    Hash, // exported blobs are hashed
+    Materialize, // stored blobs are assembled before import
+    Archive, // vault is archived by the transfer
+    Extract // vault is extracted from the archive by the transfer
+};
+
+QString name(Phase);
+
+/// prefix of unit script stdout lines reporting progress, see
+/// Event::toLine()
+extern const char linePrefix[];
+
+struct Event
+{
+    Event()
+        : phase(Phase::Export), filesDone(0), filesTotal(-1)
+        , bytesDone(0), bytesTotal(-1), rate(0), eta(-1)
+    {}
+
+    Phase phase;
+    QString unit; // empty for the whole vault operations
+    qint64 filesDone;
+    qint64 filesTotal; // -1 if it is unknown
+    qint64 bytesDone;
+    qint64 bytesTotal; // -1 if it is unknown
+    double rate; // bytes/s since the phase is started
+    qint64 eta; // s, -1 if it is unknown
+
+    /// {"type": "progress", "phase": ..., "unit": ..., "filesDone": ...}
+    QVariantMap toMap() const;
+    static Event fromMap(QVariantMap const &);
+
+    /// "progress: <json>" line printed by unit scripts
+    QByteArray toLine() const;
+    /// false if the line is not the structured progress event
+    static bool fromLine(QString const &line, Event &);
+};
+
+typedef std::function<void (Event const &)> Callback;
+
+/**
+ * Counts done files and bytes of the phase and reports them not more
+ * often than once per interval (ms). Counters can be updated from any
+ * thread, callback is called only from the thread which created the
+ * reporter, so it never runs concurrently and is not called at all
+ * if there is no callback.
+ */
+class Reporter
+{
+public:
+    enum { defaultInterval = 500 };
+
+    Reporter(Callback const &, Phase, QString const &unit = QString()
+             , int interval = defaultInterval);
+
+    void setTotal(qint64 files, qint64 bytes);
+    void addTotal(qint64 files, qint64 bytes);
+    void add(qint64 files, qint64 bytes);
+    /// absolute values, e.g. measured size of the archive
+    void set(qint64 files, qint64 bytes);
+    /// report the current state regardless of the interval, should
+    /// be called from the owner thread
+    void flush();
+
+    Event event() const;
+    inline bool isEnabled() const { return !!m_callback; }
+
+private:
+    Reporter(Reporter const &);
+    Reporter &operator =(Reporter const &);
+
+    void report();
+
+    Callback m_callback;
+    Phase m_phase;
+    QString m_unit;
+    int m_interval;
+    std::thread::id m_owner;
+    QElapsedTimer m_timer;
+    qint64 m_next;
+    std::atomic<qint64> m_filesDone;
+    std::atomic<qint64> m_filesTotal;
+    std::atomic<qint64> m_bytesDone;
+    std::atomic<qint64> m_bytesTotal;
+};
+
+}}
+
+#endif // _VAULT_PROGRESS_HPP_
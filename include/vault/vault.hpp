@@ -9,31 +9,120 @@
  */
 
 #include <functional>
+#include <exception>
+#include <memory>
 
 #include <QString>
+#include <QVariantMap>
+#include <QList>
 
 #include <gittin/repo.hpp>
 
 #include <vault/config.hpp>
+#include <vault/progress.hpp>
+#include <vault/cancel.hpp>
+
+class QIODevice;
 
 namespace vault {
 
-enum class File { Message, VersionTree, VersionRepo, State };
+namespace hash { class Cache; }
+namespace blobs { class Storage; }
+namespace catalog { class Catalog; }
+struct Unit;
+
+enum class File {
+    Message, VersionTree, VersionRepo, State, HashCache, Durations, Units
+    , Fingerprints
+};
 
 QString fileName(File);
 
 class Snapshot
 {
 public:
+    /// file or dir inside the snapshot tree
+    struct Entry
+    {
+        enum class Type { Absent, File, Dir, SymLink };
+
+        Entry() : type(Type::Absent), size(-1), isBlob(false) {}
+
+        QString name;
+        Type type;
+        qint64 size; // file size, -1 for dirs or if unknown
+        QByteArray sha; // git object or blob sha (if isBlob)
+        bool isBlob; // symlink to the blob storage, reported as file
+        QString target; // symlink target
+
+        inline bool isValid() const { return type != Type::Absent; }
+        inline bool isDir() const { return type == Type::Dir; }
+    };
+
     explicit Snapshot(const Gittin::Tag &commit);
+    Snapshot(const Gittin::Tag &commit, const QVariantMap &info, const QString &repo);
 
     inline Gittin::Tag tag() const { return m_tag; }
 
     QString name() const;
+    /// metadata from the snapshots catalog: commit, timestamp,
+    /// message, units, duration
+    inline QVariantMap info() const { return m_info; }
+    /// logical size of units data and blobs
+    inline qint64 size() const { return m_info.value("size", -1).toLongLong(); }
+    /// bytes added to the storage by this snapshot backup
+    inline qint64 addedSize() const { return m_info.value("added", -1).toLongLong(); }
+    /// bytes to be freed if snapshot is removed
+    inline qint64 uniqueSize() const { return m_info.value("unique", -1).toLongLong(); }
     void remove();
 
+    // read-only browsing of the snapshot tree w/o checkout, paths
+    // are relative to the vault root ("" is the root)
+    /// dir entries sorted by name, raises if path is not a dir
+    QList<Entry> list(const QString &path = QString()) const;
+    /// invalid entry if there is no such path
+    Entry stat(const QString &path) const;
+    /// file contents stream, blobs are read from the blob storage
+    std::unique_ptr<QIODevice> open(const QString &path) const;
+
 private:
     Gittin::Tag m_tag;
+    QVariantMap m_info;
+    QString m_repo;
+};
+
+/**
+ * Difference between two units trees (snapshots or snapshot and the
+ * current state). Changes are found on demand by next(), so the whole
+ * diff is not kept in memory.
+ */
+class Diff
+{
+public:
+    /// changed file, path is relative to the unit tree
+    struct Change
+    {
+        enum class Type { Added, Removed, Modified };
+
+        Change() : type(Type::Modified), oldSize(-1), newSize(-1) {}
+
+        QString unit;
+        QString path;
+        Type type;
+        qint64 oldSize; // -1 for added file or if size is unknown
+        qint64 newSize; // -1 for removed file or if size is unknown
+    };
+
+    struct Data;
+    explicit Diff(Data *);
+    Diff(Diff &&);
+    ~Diff();
+
+    /// false if there are no more changes
+    bool next(Change &change);
+
+private:
+    std::unique_ptr<Data> m;
 };
 
 class Vault
@@ -61,10 +150,40 @@ public:
     Vault(const QString &path);
 
     bool init(const QVariantMap &config = QVariantMap());
-    Result backup(const QString &home, const QStringList &units, const QString &message, const ProgressCallback &callback = nullptr);
-    Result restore(const Snapshot &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback = nullptr);
-    Result restore(const QString &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback = nullptr);
+    /// callback gets units status, events - progress of units
+    /// scripts, hashing etc. Both are called in the calling thread.
+    /// If operation is cancelled, running scripts are terminated,
+    /// units which are not done yet are rolled back and reported as
+    /// failed with "cancelled" status
+    Result backup(const QString &home, const QStringList &units, const QString &message, const ProgressCallback &callback = nullptr
+                  , const progress::Callback &events = nullptr, const Cancel &cancel = Cancel());
+    Result restore(const Snapshot &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback = nullptr
+                   , const progress::Callback &events = nullptr, const Cancel &cancel = Cancel());
+    Result restore(const QString &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback = nullptr
+                   , const progress::Callback &events = nullptr, const Cancel &cancel = Cancel());
+    /// write files and dirs (paths are relative to the unit tree,
+    /// all unit files if paths are empty) of the unit from the
+    /// snapshot into dst w/o running unit script. Returns count of
+    /// written files
+    int extract(const Snapshot &snapshot, const QString &unit
+                , const QStringList &paths, const QString &dst);
     bool clear(const QVariantMap &options);
+    /// changes of units (all units present in any snapshot if empty)
+    /// between snapshots
+    Diff diff(const Snapshot &from, const Snapshot &to, const QStringList &units = QStringList());
+    /// changes of units (all registered units if empty) since the
+    /// snapshot: units are exported into the scratch area, nothing is
+    /// added to the vault
+    Diff diff(const Snapshot &from, const QString &home, const QStringList &units = QStringList());
+    /// remove blobs not referenced from snapshots, it can be done in
+    /// several runs limited by budget (ms). Returns true if gc is done
+    bool gc(int budget = -1);
+    /// remove snapshots not matching retention policy ("last",
+    /// "daily", "weekly", "max-size" keys, vault.keep* options are
+    /// used if it is empty) and run gc. Returns removed tags
+    QStringList prune(const QVariantMap &policy = QVariantMap());
+    /// move small loose blobs into packs, returns count of packed blobs
+    int pack();
 
     QList<Snapshot> snapshots() const;
     Snapshot snapshot(const QByteArray &tag) const;
@@ -87,10 +206,13 @@ public:
 
 private:
     bool setState(const QString &state);
-    bool backupUnit(const QString &home, const QString &unit, const ProgressCallback &callback);
-    bool restoreUnit(const QString &home, const QString &unit, const ProgressCallback &callback);
+    bool backupUnit(Unit &unit, std::exception_ptr exportError, const ProgressCallback &callback);
+    bool restoreUnit(const QString &unit, std::exception_ptr importError
+                     , const ProgressCallback &callback);
     void tagSnapshot(const QString &msg);
     void resetMaster();
+    void resetUnsnapshotted();
+    catalog::Catalog &catalog() const;
 
     void setup(const QVariantMap *config);
     QString absolutePath(QString const &);
@@ -101,8 +223,9 @@ private:
 
     const QString m_path;
     const QString m_blobStorage;
-    Gittin::Repo m_vcs;
+    mutable Gittin::Repo m_vcs;
     config::Vault m_config;
+    mutable std::shared_ptr<catalog::Catalog> m_catalog;
 };
 
 }
@@ -17,6 +17,8 @@ public:
     {
         Q_ASSERT(QLatin1String(uri) == QLatin1String("NemoMobile.Vault"));
         qmlRegisterType<Vault>(uri, 1, 0, "Vault");
+        qmlRegisterUncreatableType<SnapshotsModel>(uri, 1, 0, "SnapshotsModel"
+                                                   , "Use Vault.snapshotsModel");
     }
 
     void initializeEngine(QQmlEngine *engine, const char *uri)
@@ -0,0 +1,77 @@
+#include "snapshots.hpp"
+
+#include <QDateTime>
+
+SnapshotsModel::SnapshotsModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int SnapshotsModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_snapshots.size();
+}
+
+QVariant SnapshotsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_snapshots.size())
+        return QVariant();
+
+    auto info = m_snapshots.at(index.row()).toMap();
+    switch (role) {
+    case Name:
+        return info.value("name");
+    case Tag:
+        return info.value("tag");
+    case Timestamp:
+        return QDateTime::fromMSecsSinceEpoch
+            (info.value("timestamp").toLongLong() * 1000, Qt::UTC);
+    case Message:
+        return info.value("message");
+    case Units:
+        return info.value("units");
+    case Duration:
+        return info.value("duration");
+    case Size:
+        return info.value("size");
+    case Added:
+        return info.value("added");
+    case Unique:
+        return info.value("unique");
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> SnapshotsModel::roleNames() const
+{
+    return {{Name, "name"}, {Tag, "tag"}, {Timestamp, "timestamp"}
+        , {Message, "message"}, {Units, "units"}, {Duration, "duration"}
+        , {Size, "size"}, {Added, "added"}, {Unique, "unique"}};
+}
+
+QVariantMap SnapshotsModel::get(int row) const
+{
+    return m_snapshots.value(row).toMap();
+}
+
+void SnapshotsModel::update(const QVariantList &snapshots)
+{
+    auto names = [](const QVariantList &list) {
+        QStringList res;
+        for (auto const &v : list)
+            res << v.toMap().value("name").toString();
+        return res;
+    };
+    if (names(snapshots) == names(m_snapshots)) {
+        // only sizes or notes can be changed
+        m_snapshots = snapshots;
+        if (!m_snapshots.isEmpty())
+            emit dataChanged(index(0), index(m_snapshots.size() - 1));
+        return;
+    }
+    beginResetModel();
+    m_snapshots = snapshots;
+    endResetModel();
+    emit countChanged();
+}
@@ -0,0 +1,43 @@
+#ifndef QML_VAULT_SNAPSHOTS_H
+#define QML_VAULT_SNAPSHOTS_H
+
+#include <QAbstractListModel>
+#include <QVariantList>
+
+// snapshots metadata read from the catalog in the background, see
+// Vault::refresh()
+class SnapshotsModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+public:
+    enum Role {
+        Name = Qt::UserRole + 1,
+        Tag,
+        Timestamp,
+        Message,
+        Units,
+        Duration,
+        Size,
+        Added,
+        Unique
+    };
+
+    explicit SnapshotsModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QHash<int, QByteArray> roleNames() const;
+
+    Q_INVOKABLE QVariantMap get(int row) const;
+
+    void update(const QVariantList &snapshots);
+
+signals:
+    void countChanged();
+
+private:
+    QVariantList m_snapshots;
+};
+
+#endif
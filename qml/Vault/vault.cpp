@@ -3,9 +3,12 @@
 #include <vault/vault.hpp>
 #include <vault/config.hpp>
 #include <transfer.hpp>
+#include <catalog.hpp>
 
 #include <QJSValue>
 
+#include <memory>
+
 #include "vault.hpp"
 
 namespace os = qtaround::os;
@@ -18,6 +21,9 @@ static const int _vault_operation_ __attribute__((unused))
 Q_DECLARE_METATYPE(Vault::ImportExportAction)
 static const int _vault_importexportaction_ __attribute__((unused))
 = qRegisterMetaType<Vault::ImportExportAction>();
+Q_DECLARE_METATYPE(vault::Cancel)
+static const int _vault_cancel_ __attribute__((unused))
+= qRegisterMetaType<vault::Cancel>();
 
 class Worker : public QObject
 {
@@ -52,32 +58,30 @@ public:
         m_vault->config().update(global->units());
     }
 
-    Q_INVOKABLE void restore(const QString &home, const QStringList &units, const QString &snapshot)
+    Q_INVOKABLE void restore(const QString &home, const QStringList &units, const QString &snapshot
+                             , vault::Cancel cancel)
     {
         debug::debug("Restore: home", home);
         m_vault->restore(snapshot, home, units, [this](const QString unit, const QString &status) {
             emit progress(Vault::Restore, {{"unit", unit}, {"status", status}});
-        });
-        emit done(Vault::Restore, QVariantMap());
+        }, [this](const vault::progress::Event &event) {
+            emit progress(Vault::Restore, event.toMap());
+        }, cancel);
+        emit finished(cancel);
+        emit done(Vault::Restore, result(cancel));
     }
 
-    Q_INVOKABLE void backup(const QString &home, const QStringList &units, const QString &message)
+    Q_INVOKABLE void backup(const QString &home, const QStringList &units, const QString &message
+                            , vault::Cancel cancel)
     {
         debug::debug("Backup: home", home);
         m_vault->backup(home, units, message, [this](const QString unit, const QString &status) {
             emit progress(Vault::Backup, {{"unit", unit}, {"status", status}});
-        });
-        emit done(Vault::Backup, QVariantMap());
-    }
-
-    QStringList snapshots() const
-    {
-        auto snapshots = m_vault->snapshots();
-        QStringList snaps;
-        for (const vault::Snapshot &ss: snapshots) {
-            snaps << ss.name();
-        }
-        return snaps;
+        }, [this](const vault::progress::Event &event) {
+            emit progress(Vault::Backup, event.toMap());
+        }, cancel);
+        emit finished(cancel);
+        emit done(Vault::Backup, result(cancel));
     }
 
     Q_INVOKABLE bool destroy()
@@ -104,9 +108,10 @@ public:
         }
     }
 
-    Q_INVOKABLE void eiExecute()
+    Q_INVOKABLE void eiExecute(vault::Cancel cancel)
     {
         if (!m_transfer) {
+            emit finished(cancel);
             emit error(Vault::ExportImportExecute
                        , map({{"message", "exportImportPrepare was not called"}
                                , {"reason", "Logic"}}));
@@ -115,13 +120,33 @@ public:
         try {
             m_transfer->execute([this](QVariantMap &&map) {
                 emit progress(Vault::ExportImportExecute, map);
-            });
+            }, cancel);
+            emit finished(cancel);
             emit done(Vault::ExportImportExecute, QVariantMap());
         } catch (error::Error e) {
+            emit finished(cancel);
             emit error(Vault::ExportImportExecute, e.m);
         }
     }
 
+    Q_INVOKABLE void resetHead()
+    {
+        m_vault->reset();
+    }
+
+    // catalog is rebuilt and saved only by the worker
+    Q_INVOKABLE void updateCatalog()
+    {
+        if (m_vault) {
+            try {
+                m_vault->snapshots();
+            } catch (error::Error e) {
+                debug::error("Error updating catalog", e.what());
+            }
+        }
+        emit catalogUpdated();
+    }
+
     Q_INVOKABLE void rmSnapshot(const QString &name)
     {
         debug::debug("Requesting snapshot removal:", name);
@@ -132,41 +157,97 @@ public:
             }
         }
 
-        if (snapshots().size() == 0) {
-            // TODO This action should be done only until proper
-            // garbage collection will be introduced
-            debug::warning("Last snapshot is removed, destroy storage to conserve space");
-            QString root = m_vault->root();
-            destroy();
-            try {
-                init(root);
-            } catch (error::Error e) {
-                debug::error("Error reconnecting", e.what());
-                emit error(Vault::RemoveSnapshot, e.m);
-            }
-        } else {
-            debug::debug("There are some snapshots, continue");
+        try {
+            m_vault->gc();
+        } catch (error::Error e) {
+            debug::error("Error collecting garbage", e.what());
+            emit error(Vault::RemoveSnapshot, e.m);
         }
         emit done(Vault::RemoveSnapshot, QVariantMap());
     }
 
+    // "cancelled" is set if operation was cancelled
+    static QVariantMap result(const vault::Cancel &cancel)
+    {
+        return cancel.isCancelled() ? QVariantMap({{"cancelled", true}}) : QVariantMap();
+    }
+
 signals:
     void progress(Vault::Operation op, const QVariantMap &map);
     void error(Vault::Operation op, const QVariantMap &error);
     void done(Vault::Operation op, const QVariantMap &);
+    void catalogUpdated();
+    // operation using the token is finished
+    void finished(vault::Cancel cancel);
 
 public:
     vault::Vault *m_vault;
     CardTransfer *m_transfer;
 };
 
+// reads snapshots catalog and units configuration in own thread, so
+// GUI thread doesn't wait for the worker busy with backup and vault
+// repository is not used concurrently. Reader never writes: outdated
+// catalog is reported to be rebuilt by the worker
+class Reader : public QObject
+{
+    Q_OBJECT
+public:
+    Q_INVOKABLE void refresh(const QString &root)
+    {
+        QVariantList snapshots;
+        QVariantMap units;
+        try {
+            if (!m_catalog || m_root != root) {
+                m_root = root;
+                m_catalog.reset(new vault::catalog::Catalog(root));
+            }
+            if (os::path::isDir(os::path::join(root, ".git"))) {
+                if (!m_catalog->load())
+                    emit outdated(root);
+                for (auto const &entry : m_catalog->entries()) {
+                    auto info = entry.toMap();
+                    info["name"] = entry.tag.mid(1);
+                    snapshots << info;
+                }
+                vault::config::Config config(vault::config::units_path(root));
+                for (auto const &unit : config.units())
+                    units.insert(unit.name(), unit.data());
+            }
+        } catch (error::Error const &e) {
+            debug::warning("Can't read vault", root, e.what());
+        }
+        emit loaded(root, snapshots, units);
+    }
+
+signals:
+    void loaded(const QString &root, const QVariantList &snapshots, const QVariantMap &units);
+    void outdated(const QString &root);
+
+private:
+    QString m_root;
+    std::unique_ptr<vault::catalog::Catalog> m_catalog;
+};
+
 
 Vault::Vault(QObject *p)
      : QObject(p)
      , m_worker(nullptr)
+     , m_reader(new Reader)
+     , m_snapshotsModel(new SnapshotsModel(this))
+     , m_isCatalogRequested(false)
      , m_home(os::home())
      , m_root(os::path::join(m_home, ".vault"))
 {
+    m_reader->moveToThread(&m_readerThread);
+    m_readerThread.start();
+    connect(m_reader, &Reader::loaded, this, &Vault::onLoaded);
+    connect(m_reader, &Reader::outdated, this, &Vault::onOutdated);
+    // read operations should not wait for the worker
+    connect(this, &Vault::done, this, [this](Operation op, const QVariantMap &) {
+            if (op != ExportImportPrepare)
+                refresh();
+        });
 }
 
 Vault::~Vault()
@@ -174,6 +255,55 @@ Vault::~Vault()
     m_workerThread.quit();
     m_workerThread.wait();
     delete m_worker;
+    m_readerThread.quit();
+    m_readerThread.wait();
+    delete m_reader;
+}
+
+void Vault::refresh()
+{
+    m_isCatalogRequested = false;
+    QMetaObject::invokeMethod(m_reader, "refresh", Q_ARG(QString, m_root));
+}
+
+void Vault::onOutdated(const QString &root)
+{
+    // rebuild is requested once per refresh, so reader and worker
+    // are not looping if catalog can't be saved
+    if (root != m_root || !m_worker || m_isCatalogRequested)
+        return;
+    m_isCatalogRequested = true;
+    QMetaObject::invokeMethod(m_worker, "updateCatalog");
+}
+
+void Vault::onLoaded(const QString &root, const QVariantList &snapshots, const QVariantMap &units)
+{
+    // result for the previous root
+    if (root != m_root)
+        return;
+
+    QStringList names;
+    m_notes.clear();
+    for (auto const &info : snapshots) {
+        auto data = info.toMap();
+        auto name = data.value("name").toString();
+        names << name;
+        m_notes.insert(name, data.value("message").toString());
+    }
+    m_snapshotsModel->update(snapshots);
+    if (names != m_snapshots) {
+        m_snapshots = names;
+        emit snapshotsChanged();
+    }
+    if (units != m_units) {
+        m_units = units;
+        emit unitsChanged();
+    }
+}
+
+SnapshotsModel *Vault::snapshotsModel() const
+{
+    return m_snapshotsModel;
 }
 
 QString Vault::root() const
@@ -191,6 +321,7 @@ void Vault::setRoot(const QString &root)
     if (m_root != root) {
         m_root = root;
         emit rootChanged();
+        refresh();
     }
 }
 
@@ -215,6 +346,12 @@ void Vault::initWorker(bool reload)
         connect(m_worker, &Worker::progress, this, &Vault::progress);
         connect(m_worker, &Worker::error, this, &Vault::error);
         connect(m_worker, &Worker::done, this, &Vault::done);
+        connect(m_worker, &Worker::finished, this, [this](vault::Cancel cancel) {
+                m_cancels.removeOne(cancel);
+            });
+        connect(m_worker, &Worker::catalogUpdated, this, [this]() {
+                QMetaObject::invokeMethod(m_reader, "refresh", Q_ARG(QString, m_root));
+            });
     }
     try {
         m_worker->init(m_root);
@@ -242,7 +379,8 @@ void Vault::startRestore(const QString &snapshot, const QStringList &units)
         return;
     }
 
-    QMetaObject::invokeMethod(m_worker, "restore", Q_ARG(QString, m_home), Q_ARG(QStringList, units), Q_ARG(QString, snapshot));
+    QMetaObject::invokeMethod(m_worker, "restore", Q_ARG(QString, m_home), Q_ARG(QStringList, units), Q_ARG(QString, snapshot)
+                              , Q_ARG(vault::Cancel, newCancel()));
 }
 
 void Vault::startBackup(const QString &message, const QStringList &units)
@@ -253,26 +391,39 @@ void Vault::startBackup(const QString &message, const QStringList &units)
         return;
     }
 
-    QMetaObject::invokeMethod(m_worker, "backup", Q_ARG(QString, m_home), Q_ARG(QStringList, units), Q_ARG(QString, message));
+    QMetaObject::invokeMethod(m_worker, "backup", Q_ARG(QString, m_home), Q_ARG(QStringList, units), Q_ARG(QString, message)
+                              , Q_ARG(vault::Cancel, newCancel()));
 }
 
 QStringList Vault::snapshots() const
 {
-    return m_worker->snapshots();
+    return m_snapshots;
 }
 
 QVariantMap Vault::units() const
 {
-    QVariantMap units;
-    for (auto &u: m_worker->m_vault->config().units()) {
-        units.insert(u.name(), u.data());
-    }
-    return units;
+    return m_units;
 }
 
 void Vault::resetHead()
 {
-    m_worker->m_vault->reset();
+    QMetaObject::invokeMethod(m_worker, "resetHead");
+}
+
+vault::Cancel Vault::newCancel()
+{
+    // each queued operation has own token, so the running one is not
+    // affected by queuing of the next one
+    vault::Cancel res;
+    m_cancels.push_back(res);
+    return res;
+}
+
+void Vault::cancel()
+{
+    // running and pending operations
+    for (auto const &cancel : m_cancels)
+        cancel.cancel();
 }
 
 void Vault::removeSnapshot(const QString &name)
@@ -287,12 +438,12 @@ void Vault::exportImportPrepare(ImportExportAction action, const QString &path)
 
 void Vault::exportImportExecute()
 {
-    QMetaObject::invokeMethod(m_worker, "eiExecute");
+    QMetaObject::invokeMethod(m_worker, "eiExecute", Q_ARG(vault::Cancel, newCancel()));
 }
 
 QString Vault::notes(const QString &snapshot) const
 {
-    return m_worker->m_vault->notes(">" + snapshot);
+    return m_notes.value(snapshot);
 }
 
 void Vault::registerUnit(const QJSValue &unit, bool global)
@@ -306,6 +457,7 @@ void Vault::registerUnit(const QJSValue &unit, bool global)
         }
         m_worker->m_vault->registerConfig(map);
     }
+    refresh();
 }
 
 #include "vault.moc"
@@ -6,15 +6,22 @@
 #include <QThread>
 #include <QStringList>
 #include <QVariantMap>
+#include <QMap>
+
+#include <vault/cancel.hpp>
+
+#include "snapshots.hpp"
 
 class QJSValue;
 class Worker;
+class Reader;
 
 class Vault : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString root READ root WRITE setRoot NOTIFY rootChanged)
     Q_PROPERTY(QString backupHome READ backupHome WRITE setBackupHome NOTIFY backupHomeChanged)
+    Q_PROPERTY(SnapshotsModel *snapshotsModel READ snapshotsModel CONSTANT)
 public:
     enum ImportExportAction {
         Export,
@@ -39,16 +46,21 @@ public:
 
     void setRoot(const QString &root);
     void setBackupHome(const QString &home);
+    SnapshotsModel *snapshotsModel() const;
 
     Q_INVOKABLE void connectVault(bool reconnect);
     Q_INVOKABLE void startBackup(const QString &message, const QStringList &units);
     Q_INVOKABLE void startRestore(const QString &snapshot, const QStringList &units);
+    // snapshots, units and notes are cached, they are updated by
+    // refresh() in the background after each operation
+    Q_INVOKABLE void refresh();
     Q_INVOKABLE QStringList snapshots() const;
     Q_INVOKABLE QVariantMap units() const;
     Q_INVOKABLE void resetHead();
     Q_INVOKABLE void removeSnapshot(const QString &name);
     Q_INVOKABLE void exportImportPrepare(ImportExportAction action, const QString &path);
     Q_INVOKABLE void exportImportExecute();
+    Q_INVOKABLE void cancel();
     Q_INVOKABLE QString notes(const QString &snapshot) const;
 
     Q_INVOKABLE void registerUnit(const QJSValue &unit, bool global);
@@ -56,6 +68,8 @@ public:
 signals:
     void rootChanged();
     void backupHomeChanged();
+    void snapshotsChanged();
+    void unitsChanged();
 
     void done(Operation operation, const QVariantMap &data);
     void progress(Operation operation, const QVariantMap &data);
@@ -63,9 +77,21 @@ signals:
 
 private:
     void initWorker(bool reload);
+    void onLoaded(const QString &root, const QVariantList &snapshots, const QVariantMap &units);
+    void onOutdated(const QString &root);
+    vault::Cancel newCancel();
 
     QThread m_workerThread;
     Worker *m_worker;
+    QThread m_readerThread;
+    Reader *m_reader;
+    SnapshotsModel *m_snapshotsModel;
+    bool m_isCatalogRequested;
+    // tokens of running and queued operations
+    QList<vault::Cancel> m_cancels;
+    QStringList m_snapshots;
+    QVariantMap m_units;
+    QMap<QString, QString> m_notes;
     QString m_home;
     QString m_root;
 };
@@ -13,6 +13,7 @@ BuildRequires: pkgconfig(tut) >= 0.0.3
 BuildRequires: pkgconfig(Qt5Core) >= 5.2.0
 BuildRequires: pkgconfig(Qt5Qml)
 BuildRequires: pkgconfig(qtaround) >= 0.2.0
+BuildRequires: pkgconfig(libzstd)
 Requires(post): /sbin/ldconfig
 Requires(postun): /sbin/ldconfig
 
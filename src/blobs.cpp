@@ -0,0 +1,803 @@
+/**
+ * @file blobs.cpp
+ * @brief Blob storage (.git/blobs) management
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "blobs.hpp"
+#include "hash.hpp"
+#include "copy.hpp"
+#include "compress.hpp"
+#include <vault/progress.hpp>
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <QHash>
+
+#include <algorithm>
+#include <cstring>
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace blobs {
+
+namespace {
+
+// gear table should never be changed: chunk boundaries of already
+// stored blobs depend on it
+struct Gear
+{
+    Gear()
+    {
+        // splitmix64 with fixed seed
+        quint64 x = 0x7661756c74ULL;
+        for (int i = 0; i < 256; ++i) {
+            quint64 z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v[i] = z ^ (z >> 31);
+        }
+    }
+    quint64 v[256];
+};
+
+const Gear gear;
+
+quint64 highMask(int bits)
+{
+    return bits <= 0 ? 0 : (~quint64(0)) << (64 - bits);
+}
+
+int log2(qint64 v)
+{
+    int res = 0;
+    while (v > 1) {
+        v >>= 1;
+        ++res;
+    }
+    return res;
+}
+
+const char *manifestSuffix = ".chunks";
+const char *compressedSuffix = ".zst";
+// small blobs are not worth to be compressed, they are packed
+const qint64 compressMinSize = 4096;
+const QByteArray manifestMagic("vault-chunks");
+const int manifestVersion = 1;
+
+const qint64 chunkMin = 256 * 1024;
+const qint64 chunkAvg = 1024 * 1024;
+const qint64 chunkMax = 4 * 1024 * 1024;
+
+QString fanOut(QString const &root, QByteArray const &sha)
+{
+    auto name = QString::fromLatin1(sha);
+    return os::path::join(root, name.left(2), name.mid(2));
+}
+
+QString fanOutName(int i)
+{
+    return QString("%1").arg(i, 2, 16, QChar('0'));
+}
+
+const QByteArray packMagic("VLTPACK1");
+const QByteArray indexMagic("VLTIDX01");
+const qint64 indexHeaderSize = 16;
+const qint64 indexEntrySize = 20 + 8 + 8 + 8;
+const qint64 copyBufferSize = 64 * 1024;
+
+void copyData(QIODevice &src, qint64 size, QIODevice &dst)
+{
+    QByteArray buf(copyBufferSize, Qt::Uninitialized);
+    while (size > 0) {
+        auto len = src.read(buf.data(), std::min(size, copyBufferSize));
+        if (len <= 0 || dst.write(buf.constData(), len) != len)
+            error::raise({{"msg", "Can't copy blob data"}, {"left", size}});
+        size -= len;
+    }
+}
+
+void ensureDir(QString const &path)
+{
+    auto dir = os::path::dirName(path);
+    if (!os::path::isDir(dir) && !os::mkdir(dir, {{"parent", true}}))
+        error::raise({{"msg", "Can't create blob dir"}, {"path", dir}});
+}
+
+// exported unit data can be placed on other fs than the storage,
+// it is cloned or copied in this case
+void move(QString const &src, QString const &dst)
+{
+    if (!::rename(QFile::encodeName(src).constData(), QFile::encodeName(dst).constData()))
+        return;
+    if (errno != EXDEV)
+        error::raise({{"msg", "Can't move blob"}, {"src", src}, {"dst", dst}});
+    // keep blob mode and mtime, as rename does
+    copy::file(src, dst, copy::Preserve);
+    os::unlink(src);
+}
+
+}
+
+Chunker::Chunker(qint64 minSize, qint64 avgSize, qint64 maxSize)
+    : m_min(minSize)
+    , m_avg(avgSize)
+    , m_max(maxSize)
+{
+    // normalized chunking: harder to find boundary before average
+    // size, easier after it
+    auto bits = log2(avgSize);
+    m_maskS = highMask(bits + 2);
+    m_maskL = highMask(bits - 2);
+}
+
+qint64 Chunker::next(char const *data, qint64 len) const
+{
+    if (len <= m_min)
+        return len;
+    if (len > m_max)
+        len = m_max;
+
+    auto normal = len < m_avg ? len : m_avg;
+    quint64 fp = 0;
+    auto p = reinterpret_cast<uchar const*>(data);
+    qint64 i = m_min;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + gear.v[p[i]];
+        if (!(fp & m_maskS))
+            return i + 1;
+    }
+    for (; i < len; ++i) {
+        fp = (fp << 1) + gear.v[p[i]];
+        if (!(fp & m_maskL))
+            return i + 1;
+    }
+    return len;
+}
+
+Manifest Manifest::read(QString const &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        error::raise({{"msg", "Can't open chunks manifest"}, {"path", path}});
+
+    Manifest res;
+    auto header = file.readLine().trimmed().split(' ');
+    if (header.size() != 4 || header[0] != manifestMagic)
+        error::raise({{"msg", "Invalid chunks manifest"}, {"path", path}});
+    if (header[1].toInt() > manifestVersion)
+        error::raise({{"msg", "Chunks manifest is newer than supported"
+                        ", upgrade vault"}, {"path", path}});
+    res.size = header[2].toLongLong();
+    res.lastModified = QDateTime::fromMSecsSinceEpoch(header[3].toLongLong());
+
+    qint64 total = 0;
+    while (!file.atEnd()) {
+        auto line = file.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        auto sep = line.indexOf(' ');
+        Chunk chunk;
+        chunk.sha = line.left(sep);
+        chunk.size = line.mid(sep + 1).toLongLong();
+        if (sep != 40 || chunk.size <= 0)
+            error::raise({{"msg", "Invalid chunk entry"}, {"path", path}
+                    , {"entry", QString::fromUtf8(line)}});
+        total += chunk.size;
+        res.chunks.push_back(chunk);
+    }
+    if (total != res.size)
+        error::raise({{"msg", "Chunks manifest size mismatch"}, {"path", path}
+                , {"size", res.size}, {"chunks", total}});
+    return res;
+}
+
+bool Manifest::write(QString const &path) const
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray header(manifestMagic);
+    header.append(' ').append(QByteArray::number(manifestVersion))
+        .append(' ').append(QByteArray::number(size))
+        .append(' ').append(QByteArray::number(lastModified.toMSecsSinceEpoch()))
+        .append('\n');
+    file.write(header);
+    for (auto const &chunk : chunks) {
+        QByteArray line(chunk.sha);
+        line.append(' ').append(QByteArray::number(chunk.size)).append('\n');
+        file.write(line);
+    }
+    return file.commit();
+}
+
+Pack::Pack(QString const &indexPath)
+    : m_index(indexPath)
+    , m_data(nullptr)
+    , m_count(0)
+{
+    if (!m_index.open(QIODevice::ReadOnly))
+        error::raise({{"msg", "Can't open pack index"}, {"path", indexPath}});
+    auto size = m_index.size();
+    if (size >= indexHeaderSize)
+        m_data = m_index.map(0, size);
+    if (!m_data || std::memcmp(m_data, indexMagic.constData(), indexMagic.size()))
+        error::raise({{"msg", "Invalid pack index"}, {"path", indexPath}});
+    m_count = qFromBigEndian<quint32>(m_data + indexMagic.size());
+    if (indexHeaderSize + qint64(m_count) * indexEntrySize != size)
+        error::raise({{"msg", "Pack index size mismatch"}, {"path", indexPath}});
+}
+
+QString Pack::packPath() const
+{
+    auto res = indexPath();
+    res.chop(3);
+    return res + "pack";
+}
+
+Pack::Entry Pack::at(quint32 i) const
+{
+    auto p = m_data + indexHeaderSize + qint64(i) * indexEntrySize;
+    Entry res;
+    res.sha = QByteArray(reinterpret_cast<char const*>(p), 20).toHex();
+    res.offset = qFromBigEndian<qint64>(p + 20);
+    res.size = qFromBigEndian<qint64>(p + 28);
+    res.lastModified = QDateTime::fromMSecsSinceEpoch(qFromBigEndian<qint64>(p + 36));
+    return res;
+}
+
+bool Pack::find(QByteArray const &sha, Entry &entry) const
+{
+    auto bin = QByteArray::fromHex(sha);
+    if (bin.size() != 20)
+        return false;
+    quint32 lo = 0, hi = m_count;
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        auto p = m_data + indexHeaderSize + qint64(mid) * indexEntrySize;
+        auto cmp = std::memcmp(p, bin.constData(), 20);
+        if (!cmp) {
+            entry = at(mid);
+            return true;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+void Pack::copy(Entry const &entry, QIODevice &dst) const
+{
+    QFile pack(packPath());
+    if (!pack.open(QIODevice::ReadOnly) || !pack.seek(entry.offset))
+        error::raise({{"msg", "Can't read pack"}, {"path", packPath()}});
+    copyData(pack, entry.size, dst);
+}
+
+QString Pack::write(QString const &dir, QList<Entry> const &src
+                    , std::function<void (Entry const &, QIODevice &)> const &writer)
+{
+    auto entries = src;
+    std::sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+            return a.sha < b.sha;
+        });
+    QCryptographicHash name(QCryptographicHash::Sha1);
+    for (auto const &e : entries)
+        name.addData(e.sha);
+    auto base = os::path::join(dir, "pack-" + QString::fromLatin1(name.result().toHex()));
+    ensureDir(base);
+
+    QSaveFile pack(base + ".pack");
+    if (!pack.open(QIODevice::WriteOnly) || pack.write(packMagic) != packMagic.size())
+        error::raise({{"msg", "Can't write pack"}, {"path", pack.fileName()}});
+    for (auto &e : entries) {
+        auto offset = pack.pos();
+        writer(e, pack);
+        if (pack.pos() - offset != e.size)
+            error::raise({{"msg", "Packed blob size mismatch"}, {"sha", QString(e.sha)}});
+        e.offset = offset;
+    }
+
+    QSaveFile index(base + ".idx");
+    QByteArray data(indexHeaderSize + entries.size() * indexEntrySize, '\0');
+    auto p = reinterpret_cast<uchar*>(data.data());
+    std::memcpy(p, indexMagic.constData(), indexMagic.size());
+    qToBigEndian<quint32>(entries.size(), p + indexMagic.size());
+    p += indexHeaderSize;
+    for (auto const &e : entries) {
+        std::memcpy(p, QByteArray::fromHex(e.sha).constData(), 20);
+        qToBigEndian<qint64>(e.offset, p + 20);
+        qToBigEndian<qint64>(e.size, p + 28);
+        qToBigEndian<qint64>(e.lastModified.toMSecsSinceEpoch(), p + 36);
+        p += indexEntrySize;
+    }
+    // index is committed last: pack is visible only when complete
+    if (!pack.commit()
+        || !index.open(QIODevice::WriteOnly)
+        || index.write(data) != data.size()
+        || !index.commit())
+        error::raise({{"msg", "Can't write pack"}, {"path", base}});
+    return index.fileName();
+}
+
+Storage::Storage(QString const &root)
+    : m_root(QFileInfo(root).absoluteFilePath())
+    , m_chunkThreshold(0)
+    , m_compressLevel(0)
+    , m_compressThreads(0)
+    , m_added(0)
+{
+}
+
+void Storage::setChunkThreshold(qint64 threshold)
+{
+    m_chunkThreshold = threshold > 0 ? threshold : 0;
+}
+
+void Storage::setCompression(int level, int threads)
+{
+    if (level > 0 && !compress::isAvailable()) {
+        debug::warning("Compression is not supported, ignoring");
+        level = 0;
+    }
+    m_compressLevel = level > 0 ? level : 0;
+    m_compressThreads = threads > 0 ? threads : 0;
+}
+
+QString Storage::path(QByteArray const &sha) const
+{
+    return fanOut(m_root, sha);
+}
+
+QString Storage::manifestPath(QByteArray const &sha) const
+{
+    return path(sha) + manifestSuffix;
+}
+
+QString Storage::compressedPath(QByteArray const &sha) const
+{
+    return path(sha) + compressedSuffix;
+}
+
+QString Storage::chunkPath(QByteArray const &sha) const
+{
+    return fanOut(os::path::join(m_root, "chunks"), sha);
+}
+
+bool Storage::contains(QByteArray const &sha) const
+{
+    PackPtr pack;
+    Pack::Entry entry;
+    return os::path::isFile(path(sha)) || os::path::isFile(manifestPath(sha))
+        || os::path::isFile(compressedPath(sha)) || findPacked(sha, pack, entry);
+}
+
+Size Storage::sizeOf(QByteArray const &sha, bool isExact) const
+{
+    Size res;
+    QFileInfo compressed(compressedPath(sha));
+    if (compressed.isFile()) {
+        QFile src(compressed.filePath());
+        if (!src.open(QIODevice::ReadOnly))
+            error::raise({{"msg", "Can't open blob"}, {"path", src.fileName()}});
+        res.size = compress::contentSize(src, isExact);
+        res.stored = compressed.size();
+        return res;
+    }
+    auto manifestFile = manifestPath(sha);
+    if (os::path::isFile(manifestFile)) {
+        auto manifest = Manifest::read(manifestFile);
+        res.size = manifest.size;
+        res.stored = 0;
+        for (auto const &chunk : manifest.chunks)
+            res.stored += chunk.size;
+        return res;
+    }
+    PackPtr pack;
+    Pack::Entry entry;
+    if (findPacked(sha, pack, entry)) {
+        res.size = res.stored = entry.size;
+        return res;
+    }
+    QFileInfo loose(path(sha));
+    if (loose.isFile())
+        res.size = res.stored = loose.size();
+    return res;
+}
+
+QString Storage::packsDir() const
+{
+    return os::path::join(m_root, "packs");
+}
+
+QList<PackPtr> Storage::packs() const
+{
+    if (!m_packs) {
+        m_packs.reset(new QList<PackPtr>());
+        QDir dir(packsDir());
+        for (auto const &name : dir.entryList({"*.idx"}, QDir::Files, QDir::Name)) {
+            try {
+                m_packs->push_back(PackPtr(new Pack(dir.filePath(name))));
+            } catch (error::Error const &e) {
+                debug::warning("Skipping pack", name, e.what());
+            }
+        }
+    }
+    return *m_packs;
+}
+
+void Storage::resetPacks()
+{
+    m_packs.reset();
+}
+
+bool Storage::findPacked(QByteArray const &sha, PackPtr &pack, Pack::Entry &entry) const
+{
+    for (auto const &p : packs()) {
+        if (p->find(sha, entry)) {
+            pack = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+QByteArray Storage::shaOf(QString const &path)
+{
+    QFileInfo info(path);
+    auto sha = (info.dir().dirName() + info.fileName()).toLatin1();
+    return sha.size() == 40 ? sha : QByteArray();
+}
+
+QString Storage::add(QString const &file, QByteArray const &sha)
+{
+    auto dst = path(sha);
+    ensureDir(dst);
+
+    QDateTime origTime = os::lastModified(file);
+    if (contains(sha)) {
+        os::unlink(file);
+    } else if (m_chunkThreshold && QFileInfo(file).size() >= m_chunkThreshold) {
+        addChunked(file, sha);
+        os::unlink(file);
+    } else if (!addCompressed(file, sha)) {
+        m_added += QFileInfo(file).size();
+        move(file, dst);
+    }
+    if (os::path::isFile(dst))
+        os::setLastModified(dst, origTime);
+    else if (os::path::isFile(compressedPath(sha)))
+        os::setLastModified(compressedPath(sha), origTime);
+    return dst;
+}
+
+bool Storage::addCompressed(QString const &file, QByteArray const &sha)
+{
+    auto size = QFileInfo(file).size();
+    if (!m_compressLevel || size < compressMinSize || !compress::isCompressible(file))
+        return false;
+
+    QFile src(file);
+    auto dst = compressedPath(sha);
+    QSaveFile out(dst);
+    if (!src.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly))
+        error::raise({{"msg", "Can't compress blob"}, {"src", file}, {"dst", dst}});
+    compress::compress(src, out, m_compressLevel, m_compressThreads);
+    // probe can be wrong, keep blob uncompressed if gain is small
+    if (out.pos() > size - size / 8) {
+        debug::debug("Blob is not compressible", file);
+        out.cancelWriting();
+        return false;
+    }
+    auto stored = out.pos();
+    if (!out.commit())
+        error::raise({{"msg", "Can't write compressed blob"}, {"path", dst}});
+    m_added += stored;
+    os::unlink(file);
+    return true;
+}
+
+QByteArray Storage::storeChunk(char const *data, qint64 len)
+{
+    auto sha = hash::blob(data, len);
+    auto dst = chunkPath(sha);
+    if (os::path::isFile(dst))
+        return sha;
+
+    ensureDir(dst);
+    QSaveFile file(dst);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(data, len) != len
+        || !file.commit())
+        error::raise({{"msg", "Can't write chunk"}, {"path", dst}});
+    m_added += len;
+    return sha;
+}
+
+void Storage::addChunked(QString const &file, QByteArray const &sha)
+{
+    QFile src(file);
+    if (!src.open(QIODevice::ReadOnly))
+        error::raise({{"msg", "Can't open blob"}, {"path", file}});
+
+    debug::debug("Chunking blob", file, sha);
+    Chunker chunker(chunkMin, chunkAvg, chunkMax);
+    Manifest manifest;
+    manifest.size = src.size();
+    manifest.lastModified = os::lastModified(file);
+
+    // window is bounded by 2 max chunks
+    QByteArray buf;
+    qint64 pos = 0, total = 0;
+    bool eof = false;
+    while (true) {
+        if (!eof && buf.size() - pos < chunker.maxSize()) {
+            buf.remove(0, pos);
+            pos = 0;
+            auto data = src.read(2 * chunker.maxSize() - buf.size());
+            if (data.isEmpty())
+                eof = true;
+            buf.append(data);
+        }
+        auto avail = buf.size() - pos;
+        if (!avail)
+            break;
+        auto len = chunker.next(buf.constData() + pos, avail);
+        Chunk chunk;
+        chunk.sha = storeChunk(buf.constData() + pos, len);
+        chunk.size = len;
+        manifest.chunks.push_back(chunk);
+        pos += len;
+        total += len;
+    }
+    if (total != manifest.size)
+        error::raise({{"msg", "Blob is changed while chunking"}, {"path", file}});
+
+    auto dst = manifestPath(sha);
+    if (!manifest.write(dst))
+        error::raise({{"msg", "Can't write chunks manifest"}, {"path", dst}});
+}
+
+QDateTime Storage::read(QByteArray const &sha, QIODevice &dst) const
+{
+    auto loose = path(sha);
+    if (os::path::isFile(loose)) {
+        QFile src(loose);
+        if (!src.open(QIODevice::ReadOnly))
+            error::raise({{"msg", "Can't open blob"}, {"path", loose}});
+        copyData(src, src.size(), dst);
+        return os::lastModified(loose);
+    }
+
+    auto compressed = compressedPath(sha);
+    if (os::path::isFile(compressed)) {
+        QFile src(compressed);
+        if (!src.open(QIODevice::ReadOnly))
+            error::raise({{"msg", "Can't open blob"}, {"path", compressed}});
+        compress::decompress(src, dst);
+        return os::lastModified(compressed);
+    }
+
+    auto src = manifestPath(sha);
+    if (!os::path::isFile(src)) {
+        PackPtr pack;
+        Pack::Entry entry;
+        if (!findPacked(sha, pack, entry))
+            error::raise({{"msg", "Blob is absent"}, {"sha", QString(sha)}});
+        pack->copy(entry, dst);
+        return entry.lastModified;
+    }
+
+    auto manifest = Manifest::read(src);
+    for (auto const &chunk : manifest.chunks) {
+        auto chunkFile = chunkPath(chunk.sha);
+        auto data = os::read_file(chunkFile);
+        if (data.size() != chunk.size)
+            error::raise({{"msg", "Chunk is broken or absent"}, {"path", chunkFile}});
+        if (dst.write(data) != chunk.size)
+            error::raise({{"msg", "Can't write blob data"}, {"sha", QString(sha)}});
+    }
+    return manifest.lastModified;
+}
+
+bool Storage::materialize(QByteArray const &sha)
+{
+    auto dst = path(sha);
+    if (os::path::isFile(dst))
+        return false;
+
+    QSaveFile file(dst);
+    if (!file.open(QIODevice::WriteOnly))
+        error::raise({{"msg", "Can't create blob"}, {"path", dst}});
+    auto lastModified = read(sha, file);
+    if (!file.commit())
+        error::raise({{"msg", "Can't write blob"}, {"path", dst}});
+    os::setLastModified(dst, lastModified);
+    m_materialized.insert(sha);
+    return true;
+}
+
+void Storage::release()
+{
+    PackPtr pack;
+    Pack::Entry entry;
+    for (auto const &sha : m_materialized) {
+        if (os::path::isFile(manifestPath(sha)) || os::path::isFile(compressedPath(sha))
+            || findPacked(sha, pack, entry))
+            os::unlink(path(sha));
+    }
+    m_materialized.clear();
+}
+
+int Storage::pack(qint64 maxBlobSize, int maxPacks)
+{
+    QList<Pack::Entry> entries;
+    for (int i = 0; i < 256; ++i) {
+        auto name = fanOutName(i);
+        QDir dir(os::path::join(m_root, name));
+        if (!dir.exists())
+            continue;
+        for (auto const &info : dir.entryInfoList(QDir::Files | QDir::Hidden)) {
+            // manifests and temporary files have suffixes
+            if (info.fileName().contains('.') || info.size() > maxBlobSize)
+                continue;
+            Pack::Entry e;
+            e.sha = (name + info.fileName()).toLatin1();
+            if (e.sha.size() != 40 || m_materialized.contains(e.sha)
+                || os::path::isFile(manifestPath(e.sha)))
+                continue;
+            e.offset = 0;
+            e.size = info.size();
+            e.lastModified = info.lastModified();
+            entries.push_back(e);
+        }
+    }
+
+    if (!entries.isEmpty()) {
+        debug::info("Packing", entries.size(), "loose blobs");
+        Pack::write(packsDir(), entries, [this](Pack::Entry const &e, QIODevice &dst) {
+                QFile src(path(e.sha));
+                if (!src.open(QIODevice::ReadOnly))
+                    error::raise({{"msg", "Can't open blob"}, {"path", src.fileName()}});
+                copyData(src, e.size, dst);
+            });
+        resetPacks();
+        for (auto const &e : entries)
+            QFile::remove(path(e.sha));
+    }
+
+    auto current = packs();
+    if (current.size() > maxPacks) {
+        debug::info("Merging", current.size(), "packs");
+        QList<Pack::Entry> merged;
+        QHash<QByteArray, PackPtr> sources;
+        for (auto const &p : current) {
+            for (quint32 i = 0; i < p->count(); ++i) {
+                auto e = p->at(i);
+                if (sources.contains(e.sha))
+                    continue;
+                sources.insert(e.sha, p);
+                merged.push_back(e);
+            }
+        }
+        auto index = Pack::write(packsDir(), merged, [&sources](Pack::Entry const &e, QIODevice &dst) {
+                sources[e.sha]->copy(e, dst);
+            });
+        for (auto const &p : current) {
+            if (p->indexPath() == index)
+                continue;
+            QFile::remove(p->indexPath());
+            QFile::remove(p->packPath());
+        }
+        resetPacks();
+    }
+    return entries.size();
+}
+
+qint64 Storage::prunePacks(QSet<QByteArray> const &live)
+{
+    qint64 freed = 0;
+    for (auto const &p : packs()) {
+        QList<Pack::Entry> entries;
+        qint64 dead = 0;
+        for (quint32 i = 0; i < p->count(); ++i) {
+            auto e = p->at(i);
+            if (live.contains(e.sha))
+                entries.push_back(e);
+            else
+                dead += e.size;
+        }
+        if (entries.size() == int(p->count()))
+            continue;
+
+        debug::debug("Pruning pack", p->packPath(), "dead bytes", dead);
+        QString index;
+        if (!entries.isEmpty())
+            index = Pack::write(packsDir(), entries, [&p](Pack::Entry const &e, QIODevice &dst) {
+                    p->copy(e, dst);
+                });
+        if (index != p->indexPath()) {
+            QFile::remove(p->indexPath());
+            QFile::remove(p->packPath());
+        }
+        freed += dead;
+    }
+    resetPacks();
+    return freed;
+}
+
+int relinkTree(Storage const &storage, QString const &dir)
+{
+    int res = 0;
+    QDirIterator it(dir, QDir::Files | QDir::System | QDir::Hidden
+                    | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        auto info = it.fileInfo();
+        if (!info.isSymLink())
+            continue;
+        // raw target, QFileInfo resolves relative targets
+        auto link = info.absoluteFilePath();
+        QByteArray target(PATH_MAX, '\0');
+        auto len = ::readlink(QFile::encodeName(link).constData(), target.data(), target.size());
+        target.truncate(len > 0 ? len : 0);
+        if (!target.contains(".git/blobs/"))
+            continue;
+        auto sha = Storage::shaOf(QString::fromUtf8(target));
+        if (sha.isEmpty())
+            continue;
+        auto blob = os::path::relative(storage.path(sha), os::path::dirName(link));
+        QFile::remove(link);
+        os::symlink(blob, link);
+        if (!os::path::isSymLink(link))
+            error::raise({{"msg", "Can't relink blob"}, {"link", link}, {"target", blob}});
+        ++res;
+    }
+    return res;
+}
+
+int materializeTree(Storage &storage, QString const &dir
+                    , progress::Reporter *reporter)
+{
+    int res = 0;
+    QDirIterator it(dir, QDir::Files | QDir::System | QDir::Hidden
+                    | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        auto info = it.fileInfo();
+        if (!info.isSymLink() || info.exists())
+            continue;
+        auto target = QFileInfo(info.symLinkTarget()).absoluteFilePath();
+        if (!target.startsWith(storage.root()))
+            continue;
+        auto sha = Storage::shaOf(target);
+        if (!sha.isEmpty() && storage.materialize(sha)) {
+            ++res;
+            if (reporter)
+                reporter->add(1, QFileInfo(info.absoluteFilePath()).size());
+        }
+    }
+    return res;
+}
+
+}}
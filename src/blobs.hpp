@@ -0,0 +1,208 @@
+#ifndef _VAULT_BLOBS_HPP_
+#define _VAULT_BLOBS_HPP_
+/**
+ * @file blobs.hpp
+ * @brief Blob storage (.git/blobs) management
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+#include <QSet>
+#include <QFile>
+
+#include <memory>
+#include <functional>
+
+namespace vault {
+
+namespace progress { class Reporter; }
+
+namespace blobs {
+
+/**
+ * Content-defined chunker (FastCDC-like, gear rolling hash with
+ * normalized chunking). Boundaries depend only on content, so
+ * insertion/removal in the middle of the file affects only nearby
+ * chunks.
+ */
+class Chunker
+{
+public:
+    Chunker(qint64 minSize, qint64 avgSize, qint64 maxSize);
+
+    /// length of the next chunk starting at data
+    qint64 next(char const *data, qint64 len) const;
+
+    inline qint64 maxSize() const { return m_max; }
+
+private:
+    qint64 m_min;
+    qint64 m_avg;
+    qint64 m_max;
+    quint64 m_maskS;
+    quint64 m_maskL;
+};
+
+struct Chunk
+{
+    QByteArray sha;
+    qint64 size;
+};
+
+/// description of the file stored as a sequence of chunks
+struct Manifest
+{
+    qint64 size;
+    QDateTime lastModified;
+    QList<Chunk> chunks;
+
+    static Manifest read(QString const &path);
+    bool write(QString const &path) const;
+};
+
+/**
+ * Pack of blobs: <name>.pack contains blobs data one after another,
+ * <name>.idx is the table of entries sorted by binary sha (mapped
+ * into memory and searched using bisection). Entry is: sha(20),
+ * offset(8), size(8), mtime(8, ms), numbers are big-endian.
+ */
+class Pack
+{
+public:
+    struct Entry
+    {
+        QByteArray sha;
+        qint64 offset;
+        qint64 size;
+        QDateTime lastModified;
+    };
+
+    explicit Pack(QString const &indexPath);
+
+    inline QString indexPath() const { return m_index.fileName(); }
+    QString packPath() const;
+    inline quint32 count() const { return m_count; }
+
+    bool find(QByteArray const &sha, Entry &) const;
+    Entry at(quint32 i) const;
+    /// copy blob data to dst device
+    void copy(Entry const &, QIODevice &dst) const;
+
+    static QString write(QString const &dir, QList<Entry> const &
+                         , std::function<void (Entry const &, QIODevice &)> const &);
+private:
+    QFile m_index;
+    uchar const *m_data;
+    quint32 m_count;
+};
+
+typedef std::shared_ptr<Pack> PackPtr;
+
+struct Size
+{
+    Size() : size(-1), stored(-1) {}
+    bool isValid() const { return size >= 0; }
+    qint64 size; // original data size
+    qint64 stored; // occupied in the storage
+};
+
+/**
+ * Blob storage layout:
+ * - <root>/<2>/<38> - whole (loose) blob
+ * - <root>/<2>/<38>.zst - compressed loose blob
+ * - <root>/<2>/<38>.chunks - manifest of the chunked blob
+ * - <root>/chunks/<2>/<38> - chunks shared between all blobs
+ * - <root>/packs/pack-<sha>.{pack,idx} - packed small blobs
+ *
+ * Blobs are symlinked from units trees to the loose path. For
+ * compressed, chunked or packed blob loose file is created by materialize() only while it
+ * is needed (restore) and removed by release(), so restore needs
+ * free space for the full size of such blobs.
+ */
+class Storage
+{
+public:
+    explicit Storage(QString const &root);
+
+    inline QString root() const { return m_root; }
+
+    /// files with size >= threshold are chunked, 0 disables chunking
+    void setChunkThreshold(qint64 threshold);
+    /// compress new loose blobs using zstd if level > 0 and the
+    /// content looks compressible
+    void setCompression(int level, int threads = 0);
+
+    QString path(QByteArray const &sha) const;
+    QString manifestPath(QByteArray const &sha) const;
+    QString compressedPath(QByteArray const &sha) const;
+    QString chunkPath(QByteArray const &sha) const;
+
+    bool contains(QByteArray const &sha) const;
+    /// invalid if there is no such blob. Stored size of chunked blob
+    /// includes chunks shared with other blobs. If isExact is false
+    /// compressed blob w/o recorded content size is not decompressed,
+    /// its size is -1
+    Size sizeOf(QByteArray const &sha, bool isExact = true) const;
+
+    /// move file into the storage (file is removed if blob already
+    /// exists), returns path to be symlinked
+    QString add(QString const &file, QByteArray const &sha);
+    /// bytes written to the storage by add() since creation
+    inline qint64 addedBytes() const { return m_added; }
+
+    /// write blob contents into dst w/o materializing it, returns
+    /// blob modification time. Raises if there is no such blob
+    QDateTime read(QByteArray const &sha, QIODevice &dst) const;
+    /// make loose blob file available, returns false if it was
+    /// already available
+    bool materialize(QByteArray const &sha);
+    /// remove blobs temporary created by materialize()
+    void release();
+
+    /// blob sha for the path inside the storage (loose path)
+    static QByteArray shaOf(QString const &path);
+
+    QList<PackPtr> packs() const;
+    /// move loose blobs not bigger than maxBlobSize into a new
+    /// pack. If there are more than maxPacks packs after that, all
+    /// packs are merged. Returns count of packed blobs
+    int pack(qint64 maxBlobSize, int maxPacks);
+    /// rewrite packs dropping blobs absent in the live set, returns
+    /// freed bytes
+    qint64 prunePacks(QSet<QByteArray> const &live);
+
+private:
+    void addChunked(QString const &file, QByteArray const &sha);
+    bool addCompressed(QString const &file, QByteArray const &sha);
+    QByteArray storeChunk(char const *data, qint64 len);
+    bool findPacked(QByteArray const &sha, PackPtr &, Pack::Entry &) const;
+    QString packsDir() const;
+    void resetPacks();
+
+    QString m_root;
+    qint64 m_chunkThreshold;
+    int m_compressLevel;
+    int m_compressThreads;
+    qint64 m_added;
+    QSet<QByteArray> m_materialized;
+    mutable std::unique_ptr<QList<PackPtr> > m_packs;
+};
+
+/// blob symlinks of the unit tree checked out outside of the vault
+/// worktree are pointed to the storage again, returns count of links
+int relinkTree(Storage const &, QString const &dir);
+
+/// make all blobs symlinked from the dir tree available, returns
+/// count of materialized blobs. Each of them is added to the progress
+int materializeTree(Storage &, QString const &dir
+                    , progress::Reporter *reporter = nullptr);
+
+}}
+
+#endif // _VAULT_BLOBS_HPP_
@@ -0,0 +1,204 @@
+/**
+ * @file browse.cpp
+ * @brief Snapshot trees browsing w/o checkout
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "browse.hpp"
+#include "blobs.hpp"
+#include "git.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+
+#include <QDir>
+#include <QMutexLocker>
+#include <QBuffer>
+#include <QTemporaryFile>
+
+#include <algorithm>
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+
+namespace vault {
+
+namespace browse {
+
+namespace {
+
+// count of entries of all cached trees
+const int defaultCapacity = 64 * 1024;
+
+}
+
+Trees::Trees(QString const &repo, int capacity)
+    : m_repo(repo)
+    , m_trees(capacity)
+{
+}
+
+std::shared_ptr<Trees> Trees::get(QString const &repo)
+{
+    static QMutex lock;
+    static QHash<QString, std::shared_ptr<Trees> > all;
+    QMutexLocker l(&lock);
+    auto path = QDir(repo).absolutePath();
+    auto &res = all[path];
+    if (!res)
+        res = std::make_shared<Trees>(path, defaultCapacity);
+    return res;
+}
+
+Entries Trees::decode(QByteArray const &tree) const
+{
+    typedef Snapshot::Entry::Type Type;
+    Entries res;
+    QList<QByteArray> links;
+    QList<int> linkPos;
+    for (auto const &e : git::lsTree(m_repo, tree, false, true)) {
+        Snapshot::Entry entry;
+        entry.name = e.path;
+        entry.sha = e.sha;
+        if (e.isTree()) {
+            entry.type = Type::Dir;
+        } else if (e.isSymLink()) {
+            entry.type = Type::SymLink;
+            entry.size = e.size;
+            links.push_back(e.sha);
+            linkPos.push_back(res.size());
+        } else if (e.type == "blob") {
+            entry.type = Type::File;
+            entry.size = e.size;
+        } else {
+            // submodules are not used by vault
+            continue;
+        }
+        res.push_back(entry);
+    }
+
+    blobs::Storage storage(os::path::join(m_repo, ".git", "blobs"));
+    auto targets = git::catFiles(m_repo, links);
+    for (int i = 0; i < targets.size(); ++i) {
+        auto &entry = res[linkPos[i]];
+        entry.target = QString::fromUtf8(targets[i]);
+        auto sha = targets[i].contains(".git/blobs/")
+            ? blobs::Storage::shaOf(entry.target) : QByteArray();
+        if (sha.isEmpty())
+            continue;
+        entry.type = Type::File;
+        entry.isBlob = true;
+        entry.sha = sha;
+        // listing should be cheap: blobs compressed w/o content
+        // size in the header are not decompressed to get the size
+        auto size = storage.sizeOf(sha, false);
+        entry.size = size.isValid() ? size.size : -1;
+    }
+    std::sort(res.begin(), res.end(), [](Snapshot::Entry const &a, Snapshot::Entry const &b) {
+            return a.name < b.name;
+        });
+    return res;
+}
+
+Entries Trees::entries(QByteArray const &tree)
+{
+    QMutexLocker l(&m_lock);
+    auto cached = m_trees.object(tree);
+    if (cached)
+        return *cached;
+    auto res = decode(tree);
+    // empty trees have the cost too
+    m_trees.insert(tree, new Entries(res), std::max(res.size(), 1));
+    return res;
+}
+
+Snapshot::Entry Trees::stat(QString const &tag, QString const &path)
+{
+    QByteArray root;
+    {
+        QMutexLocker l(&m_lock);
+        root = m_roots.value(tag);
+    }
+    if (root.isEmpty()) {
+        root = git::output(m_repo, {"rev-parse", "--verify"
+                    , "refs/tags/" + tag + "^{tree}"}).trimmed();
+        QMutexLocker l(&m_lock);
+        m_roots.insert(tag, root);
+    }
+
+    Snapshot::Entry res;
+    res.type = Snapshot::Entry::Type::Dir;
+    res.sha = root;
+    for (auto const &name : path.split('/', QString::SkipEmptyParts)) {
+        if (!res.isDir())
+            return Snapshot::Entry();
+        auto children = entries(res.sha);
+        auto found = std::lower_bound
+            (children.begin(), children.end(), name
+             , [](Snapshot::Entry const &e, QString const &name) {
+                return e.name < name;
+            });
+        if (found == children.end() || found->name != name)
+            return Snapshot::Entry();
+        res = *found;
+    }
+    return res;
+}
+
+}
+
+QList<Snapshot::Entry> Snapshot::list(const QString &path) const
+{
+    if (m_repo.isEmpty())
+        error::raise({{"msg", "Snapshot is not bound to vault"}, {"tag", m_tag.name()}});
+    auto trees = browse::Trees::get(m_repo);
+    auto entry = trees->stat(m_tag.name(), path);
+    if (!entry.isDir())
+        error::raise({{"msg", "Not a dir"}, {"path", path}, {"snapshot", name()}});
+    return trees->entries(entry.sha);
+}
+
+Snapshot::Entry Snapshot::stat(const QString &path) const
+{
+    if (m_repo.isEmpty())
+        error::raise({{"msg", "Snapshot is not bound to vault"}, {"tag", m_tag.name()}});
+    return browse::Trees::get(m_repo)->stat(m_tag.name(), path);
+}
+
+std::unique_ptr<QIODevice> Snapshot::open(const QString &path) const
+{
+    auto entry = stat(path);
+    if (entry.type != Entry::Type::File)
+        error::raise({{"msg", "Not a file"}, {"path", path}, {"snapshot", name()}});
+
+    std::unique_ptr<QIODevice> res;
+    if (!entry.isBlob) {
+        auto buf = new QBuffer();
+        res.reset(buf);
+        buf->setData(git::catFiles(m_repo, {entry.sha}).first());
+        buf->open(QIODevice::ReadOnly);
+        return res;
+    }
+
+    blobs::Storage storage(os::path::join(m_repo, ".git", "blobs"));
+    auto loose = storage.path(entry.sha);
+    if (os::path::isFile(loose)) {
+        res.reset(new QFile(loose));
+        if (!res->open(QIODevice::ReadOnly))
+            error::raise({{"msg", "Can't open blob"}, {"path", loose}});
+        return res;
+    }
+    // compressed, chunked or packed blob is decoded into the
+    // temporary file removed on close
+    auto tmp = new QTemporaryFile();
+    res.reset(tmp);
+    if (!tmp->open())
+        error::raise({{"msg", "Can't create temporary file"}});
+    storage.read(entry.sha, *tmp);
+    tmp->seek(0);
+    return res;
+}
+
+}
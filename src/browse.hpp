@@ -0,0 +1,56 @@
+#ifndef _VAULT_BROWSE_HPP_
+#define _VAULT_BROWSE_HPP_
+/**
+ * @file browse.hpp
+ * @brief Snapshot trees browsing w/o checkout
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <vault/vault.hpp>
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QCache>
+#include <QMutex>
+
+#include <memory>
+
+namespace vault { namespace browse {
+
+typedef QList<Snapshot::Entry> Entries;
+
+/**
+ * Decoded git tree objects of the vault. Tree is read (ls-tree and
+ * cat-file for symlink targets) only when it is visited, blob links
+ * are resolved to the blob storage entries. Trees are immutable, so
+ * cached entries are never invalidated, the least recently used trees
+ * are dropped when the count of cached entries exceeds capacity.
+ */
+class Trees
+{
+public:
+    Trees(QString const &repo, int capacity);
+
+    /// trees cache shared by all snapshots of the vault
+    static std::shared_ptr<Trees> get(QString const &repo);
+
+    /// entries of the tree object sorted by name
+    Entries entries(QByteArray const &tree);
+    /// path entry inside the tree of the snapshot tag
+    Snapshot::Entry stat(QString const &tag, QString const &path);
+
+private:
+    Entries decode(QByteArray const &tree) const;
+
+    QString m_repo;
+    QMutex m_lock;
+    QCache<QByteArray, Entries> m_trees;
+    QHash<QString, QByteArray> m_roots;
+};
+
+}}
+
+#endif // _VAULT_BROWSE_HPP_
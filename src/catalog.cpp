@@ -0,0 +1,291 @@
+/**
+ * @file catalog.cpp
+ * @brief Persistent catalog of snapshots
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "catalog.hpp"
+#include "git.hpp"
+#include "blobs.hpp"
+#include "usage.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QDir>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QVariantList>
+
+#include <algorithm>
+
+#include <sys/stat.h>
+
+namespace os = qtaround::os;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace catalog {
+
+static const int formatVersion = 1;
+
+namespace {
+
+// mtime of the dir and all nested dirs: tag creation or removal
+// changes mtime of the dir containing the tag
+QByteArray dirsStamp(QString const &path)
+{
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st))
+        return "-1";
+    auto res = QByteArray::number(qint64(st.st_mtim.tv_sec))
+        + '.' + QByteArray::number(qint64(st.st_mtim.tv_nsec));
+    QDir dir(path);
+    for (auto const &name : dir.entryList(QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot))
+        res += ' ' + dirsStamp(dir.filePath(name));
+    return res;
+}
+
+}
+
+QVariantMap Entry::toMap() const
+{
+    return {{"tag", tag}
+        , {"commit", QString::fromLatin1(commit)}
+        , {"timestamp", timestamp}
+        , {"message", message}
+        , {"units", units}
+        , {"duration", duration}
+        , {"size", size}
+        , {"added", added}
+        , {"unique", unique}};
+}
+
+Entry Entry::fromMap(QVariantMap const &data)
+{
+    Entry res;
+    res.tag = data.value("tag").toString();
+    res.commit = data.value("commit").toString().toLatin1();
+    res.timestamp = data.value("timestamp").toLongLong();
+    res.message = data.value("message").toString();
+    res.units = data.value("units").toMap();
+    res.duration = data.value("duration", -1).toLongLong();
+    res.size = data.value("size", -1).toLongLong();
+    res.added = data.value("added", -1).toLongLong();
+    res.unique = data.value("unique", -1).toLongLong();
+    return res;
+}
+
+Catalog::Catalog(QString const &repo)
+    : m_repo(repo)
+    , m_fname(os::path::join(repo, ".git", "vault.catalog"))
+{
+}
+
+QByteArray Catalog::refsStamp() const
+{
+    // tag creation/removal changes refs/tags dirs mtime, packed tags
+    // are changed by pack-refs or removal
+    auto tags = dirsStamp(os::path::join(m_repo, ".git", "refs", "tags"));
+    auto packed = hash::stat(os::path::join(m_repo, ".git", "packed-refs"));
+    return tags
+        + ' ' + QByteArray::number(packed.size)
+        + ' ' + QByteArray::number(packed.mtime);
+}
+
+bool Catalog::read()
+{
+    QFile file(m_fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    auto data = QJsonDocument::fromJson(file.readAll()).toVariant().toMap();
+    if (data.value("version").toInt() != formatVersion)
+        return false;
+
+    m_entries.clear();
+    for (auto const &v : data.value("snapshots").toList()) {
+        auto entry = Entry::fromMap(v.toMap());
+        if (!entry.tag.isEmpty())
+            m_entries.insert(entry.tag, entry);
+    }
+    m_stamp = data.value("stamp").toString().toLatin1();
+    return true;
+}
+
+void Catalog::refresh()
+{
+    auto fileStat = hash::stat(m_fname);
+    auto stamp = refsStamp();
+    if (fileStat.isValid() && fileStat.size == m_fileStat.size
+        && fileStat.mtime == m_fileStat.mtime && stamp == m_stamp)
+        return;
+
+    if (read() && m_stamp == stamp) {
+        m_fileStat = fileStat;
+        return;
+    }
+    debug::info("Snapshots catalog is outdated, rebuilding");
+    rebuild();
+    updateSizes();
+    if (!save())
+        debug::warning("Can't save snapshots catalog", m_fname);
+}
+
+bool Catalog::load()
+{
+    auto fileStat = hash::stat(m_fname);
+    if (!read()) {
+        m_entries.clear();
+        return false;
+    }
+    m_fileStat = fileStat;
+    return m_stamp == refsStamp();
+}
+
+bool Catalog::save()
+{
+    QVariantList snapshots;
+    for (auto const &entry : entries())
+        snapshots.push_back(entry.toMap());
+    auto stamp = refsStamp();
+    QVariantMap data = {{"version", formatVersion}
+                        , {"stamp", QString::fromLatin1(stamp)}
+                        , {"snapshots", snapshots}};
+
+    QSaveFile file(m_fname);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument::fromVariant(data).toJson(QJsonDocument::Compact));
+    if (!file.commit())
+        return false;
+    m_stamp = stamp;
+    m_fileStat = hash::stat(m_fname);
+    return true;
+}
+
+void Catalog::rebuild()
+{
+    // backup duration and added bytes can't be restored from git
+    auto known = m_entries;
+    m_entries.clear();
+    auto refs = git::output(m_repo, {"for-each-ref"
+                , "--format=%(refname)%00%(objectname)%00%(*objectname)"
+                "%00%(committerdate:raw)%00%(*committerdate:raw)"
+                , "refs/tags"});
+    QList<Entry> found;
+    for (auto const &line : refs.split('\n')) {
+        auto fields = line.split('\0');
+        if (fields.size() != 5)
+            continue;
+        auto tag = QString::fromUtf8(fields[0].mid(sizeof("refs/tags/") - 1));
+        if (!tag.startsWith('>'))
+            continue;
+        Entry entry;
+        entry.tag = tag;
+        // annotated tag is peeled to the commit
+        auto isAnnotated = !fields[2].isEmpty();
+        entry.commit = isAnnotated ? fields[2] : fields[1];
+        entry.timestamp = (isAnnotated ? fields[4] : fields[3]).split(' ')[0].toLongLong();
+        found.push_back(entry);
+    }
+    if (found.isEmpty())
+        return;
+
+    // notes are attached to snapshot commits
+    QHash<QByteArray, QByteArray> noteShas;
+    for (auto const &line : git::output(m_repo, {"notes", "list"}).split('\n')) {
+        auto ids = line.trimmed().split(' ');
+        if (ids.size() == 2)
+            noteShas.insert(ids[1], ids[0]);
+    }
+    QList<QByteArray> objects;
+    for (auto const &entry : found)
+        objects.push_back(entry.commit + ":.units.json");
+    QList<int> withNotes;
+    for (int i = 0; i < found.size(); ++i) {
+        auto note = noteShas.value(found[i].commit);
+        if (!note.isEmpty()) {
+            objects.push_back(note);
+            withNotes.push_back(i);
+        }
+    }
+    auto contents = git::catFiles(m_repo, objects, true);
+    for (int i = 0; i < withNotes.size(); ++i) {
+        auto &entry = found[withNotes[i]];
+        entry.message = QString::fromUtf8(contents[found.size() + i]).trimmed();
+    }
+
+    // snapshots made before .units.json was introduced: units are top
+    // level dirs
+    QList<QByteArray> trees;
+    QList<int> withoutUnits;
+    for (int i = 0; i < found.size(); ++i) {
+        auto &entry = found[i];
+        if (!contents[i].isEmpty()) {
+            entry.units = QJsonDocument::fromJson(contents[i]).toVariant().toMap();
+        } else {
+            trees.push_back(entry.commit + "^{tree}");
+            withoutUnits.push_back(i);
+        }
+    }
+    auto treeData = git::catFiles(m_repo, trees, true);
+    for (int i = 0; i < withoutUnits.size(); ++i) {
+        auto &entry = found[withoutUnits[i]];
+        for (auto const &e : git::parseTree(treeData[i])) {
+            if (e.isTree() && !e.path.startsWith('.'))
+                entry.units.insert(e.path, QVariantMap());
+        }
+    }
+    for (auto &entry : found) {
+        auto it = known.find(entry.tag);
+        if (it != known.end() && it.value().commit == entry.commit) {
+            entry.duration = it.value().duration;
+            entry.added = it.value().added;
+        }
+        m_entries.insert(entry.tag, entry);
+    }
+}
+
+void Catalog::updateSizes()
+{
+    if (m_entries.isEmpty())
+        return;
+    blobs::Storage storage(os::path::join(m_repo, ".git", "blobs"));
+    auto sizes = usage::compute(m_repo, storage);
+    for (auto &entry : m_entries) {
+        auto it = sizes.find(entry.commit);
+        if (it == sizes.end())
+            continue;
+        entry.size = it.value().size;
+        entry.unique = it.value().unique;
+    }
+}
+
+Entry const *Catalog::find(QString const &tag) const
+{
+    auto it = m_entries.find(tag);
+    return it == m_entries.end() ? nullptr : &it.value();
+}
+
+QList<Entry> Catalog::entries() const
+{
+    auto res = m_entries.values();
+    std::sort(res.begin(), res.end(), [](Entry const &a, Entry const &b) {
+            return a.tag < b.tag;
+        });
+    return res;
+}
+
+void Catalog::insert(Entry const &entry)
+{
+    m_entries.insert(entry.tag, entry);
+}
+
+void Catalog::remove(QString const &tag)
+{
+    m_entries.remove(tag);
+}
+
+}}
@@ -0,0 +1,89 @@
+#ifndef _VAULT_CATALOG_HPP_
+#define _VAULT_CATALOG_HPP_
+/**
+ * @file catalog.hpp
+ * @brief Persistent catalog of snapshots
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "hash.hpp"
+
+#include <QString>
+#include <QByteArray>
+#include <QVariantMap>
+#include <QHash>
+#include <QList>
+
+namespace vault { namespace catalog {
+
+struct Entry
+{
+    Entry() : timestamp(0), duration(-1), size(-1), added(-1), unique(-1) {}
+
+    QString tag; // snapshot tag name, starts with '>'
+    QByteArray commit;
+    qint64 timestamp; // commit time, seconds since epoch
+    QString message; // snapshot notes
+    QVariantMap units; // unit -> info saved in .units.json
+    qint64 duration; // backup duration (ms), -1 if unknown
+    // bytes, -1 if unknown
+    qint64 size; // logical size of units data and blobs
+    qint64 added; // written to blob storage and git objects by backup
+    qint64 unique; // freed by snapshot removal (and gc)
+
+    QVariantMap toMap() const;
+    static Entry fromMap(QVariantMap const &);
+};
+
+/**
+ * Snapshots metadata stored in .git/vault.catalog, so listing of
+ * snapshots and their notes does not require git calls. Catalog is
+ * updated on backup and snapshot removal. It is rebuilt from git if
+ * it is missing or snapshot tags were changed by other means: refs
+ * stamp (mtime of refs/tags dirs and stat of packed-refs) is saved
+ * with the catalog. Backup duration and added bytes of known
+ * snapshots are kept on rebuild.
+ */
+class Catalog
+{
+public:
+    explicit Catalog(QString const &repo);
+
+    /// re-read catalog if it was changed since the last refresh
+    void refresh();
+    /// read the saved catalog only, it is never rebuilt or saved, so
+    /// it can be used while other process or thread is writing
+    /// it. Returns false if it is missing or tags were changed since
+    /// it was saved
+    bool load();
+    bool save();
+    /// read all snapshots metadata from git
+    void rebuild();
+    /// recalculate size and unique bytes of all snapshots
+    void updateSizes();
+
+    /// nullptr if there is no such snapshot
+    Entry const *find(QString const &tag) const;
+    /// sorted by tag name
+    QList<Entry> entries() const;
+    inline int size() const { return m_entries.size(); }
+
+    void insert(Entry const &);
+    void remove(QString const &tag);
+
+private:
+    QByteArray refsStamp() const;
+    bool read();
+
+    QString m_repo;
+    QString m_fname;
+    QByteArray m_stamp;
+    hash::Stat m_fileStat;
+    QHash<QString, Entry> m_entries;
+};
+
+}}
+
+#endif // _VAULT_CATALOG_HPP_
@@ -0,0 +1,263 @@
+/**
+ * @file compress.cpp
+ * @brief Blob compression (zstd)
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "compress.hpp"
+
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QByteArray>
+#include <QList>
+
+#include <cmath>
+#include <memory>
+
+#ifdef VAULT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace compress {
+
+namespace {
+
+const qint64 probeSize = 64 * 1024;
+// bits per byte, compressed/encrypted data is close to 8
+const double maxEntropy = 7.5;
+
+struct Signature
+{
+    int offset;
+    QByteArray magic;
+};
+
+// formats already compressed by themselves
+QList<Signature> const &signatures()
+{
+    static const QList<Signature> res = {
+        {0, QByteArray("\xff\xd8\xff", 3)}              // jpeg
+        , {0, QByteArray("\x89PNG", 4)}
+        , {0, "GIF8"}
+        , {0, "RIFF"}                                   // only webp, see below
+        , {4, "ftyp"}                                   // mp4/3gp/mov
+        , {0, QByteArray("\x1a\x45\xdf\xa3", 4)}        // matroska/webm
+        , {0, "OggS"}
+        , {0, "fLaC"}
+        , {0, "ID3"}                                    // mp3
+        , {0, QByteArray("\xff\xfb", 2)}                // mp3 w/o tag
+        , {0, QByteArray("PK\x03\x04", 4)}              // zip/odf/ooxml/apk
+        , {0, QByteArray("\x1f\x8b", 2)}                // gzip
+        , {0, "BZh"}
+        , {0, QByteArray("\xfd" "7zXZ\x00", 6)}         // xz
+        , {0, QByteArray("7z\xbc\xaf\x27\x1c", 6)}
+        , {0, QByteArray("\x28\xb5\x2f\xfd", 4)}        // zstd
+        , {0, "Rar!"}
+    };
+    return res;
+}
+
+bool isCompressedFormat(QByteArray const &head)
+{
+    for (auto const &s : signatures()) {
+        if (head.mid(s.offset, s.magic.size()) != s.magic)
+            continue;
+        // RIFF is a container for uncompressed wav too
+        if (s.magic == "RIFF")
+            return head.mid(8, 4) == "WEBP";
+        return true;
+    }
+    return false;
+}
+
+double entropy(QByteArray const &data)
+{
+    if (data.isEmpty())
+        return 0;
+    qint64 counts[256] = {0};
+    for (auto c : data)
+        ++counts[uchar(c)];
+    double res = 0;
+    for (auto n : counts) {
+        if (!n)
+            continue;
+        double p = double(n) / data.size();
+        res -= p * std::log2(p);
+    }
+    return res;
+}
+
+}
+
+bool isCompressible(QString const &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    auto head = file.read(probeSize);
+    if (isCompressedFormat(head))
+        return false;
+
+    // header can be not representative, sample the middle too
+    auto sample = head;
+    auto size = file.size();
+    if (size > 4 * probeSize && file.seek(size / 2))
+        sample.append(file.read(probeSize));
+    return entropy(sample) < maxEntropy;
+}
+
+#ifdef VAULT_HAVE_ZSTD
+
+namespace {
+
+void check(size_t rc, char const *msg)
+{
+    if (ZSTD_isError(rc))
+        error::raise({{"msg", msg}, {"error", ZSTD_getErrorName(rc)}});
+}
+
+// discards written data
+class Sink : public QIODevice
+{
+protected:
+    qint64 readData(char *, qint64) { return -1; }
+    qint64 writeData(char const *, qint64 len) { return len; }
+};
+
+void write(QIODevice &dst, char const *data, size_t len)
+{
+    if (len && dst.write(data, len) != qint64(len))
+        error::raise({{"msg", "Can't write"}, {"error", dst.errorString()}});
+}
+
+}
+
+bool isAvailable()
+{
+    return true;
+}
+
+void compress(QIODevice &src, QIODevice &dst, int level, int threads)
+{
+    std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> ctx
+        (ZSTD_createCCtx(), &ZSTD_freeCCtx);
+    if (!ctx)
+        error::raise({{"msg", "Can't create zstd context"}});
+    check(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, level)
+          , "Invalid compression level");
+    check(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_checksumFlag, 1)
+          , "Can't enable checksum");
+    // 0 means single-threaded mode, it is also error if zstd is
+    // built w/o threads support
+    if (threads > 0 && ZSTD_isError(ZSTD_CCtx_setParameter
+                                    (ctx.get(), ZSTD_c_nbWorkers, threads)))
+        debug::warning("zstd is built w/o threads, compressing in 1 thread");
+    // content size is saved in the frame header, see contentSize()
+    if (!src.isSequential())
+        check(ZSTD_CCtx_setPledgedSrcSize(ctx.get(), src.size() - src.pos())
+              , "Can't set source size");
+
+    QByteArray in(ZSTD_CStreamInSize(), Qt::Uninitialized);
+    QByteArray out(ZSTD_CStreamOutSize(), Qt::Uninitialized);
+    while (true) {
+        auto len = src.read(in.data(), in.size());
+        if (len < 0)
+            error::raise({{"msg", "Can't read"}, {"error", src.errorString()}});
+        auto mode = len ? ZSTD_e_continue : ZSTD_e_end;
+        ZSTD_inBuffer input = { in.constData(), size_t(len), 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { out.data(), size_t(out.size()), 0 };
+            remaining = ZSTD_compressStream2(ctx.get(), &output, &input, mode);
+            check(remaining, "Compression failed");
+            write(dst, out.constData(), output.pos);
+        } while (mode == ZSTD_e_end ? remaining : input.pos < input.size);
+        if (!len)
+            break;
+    }
+}
+
+qint64 decompress(QIODevice &src, QIODevice &dst)
+{
+    std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx
+        (ZSTD_createDCtx(), &ZSTD_freeDCtx);
+    if (!ctx)
+        error::raise({{"msg", "Can't create zstd context"}});
+
+    QByteArray in(ZSTD_DStreamInSize(), Qt::Uninitialized);
+    QByteArray out(ZSTD_DStreamOutSize(), Qt::Uninitialized);
+    qint64 total = 0;
+    size_t last = 0;
+    while (true) {
+        auto len = src.read(in.data(), in.size());
+        if (len < 0)
+            error::raise({{"msg", "Can't read"}, {"error", src.errorString()}});
+        if (!len)
+            break;
+        ZSTD_inBuffer input = { in.constData(), size_t(len), 0 };
+        bool isFull;
+        // full output buffer means there can be more data to flush
+        do {
+            ZSTD_outBuffer output = { out.data(), size_t(out.size()), 0 };
+            last = ZSTD_decompressStream(ctx.get(), &output, &input);
+            check(last, "Decompression failed");
+            write(dst, out.constData(), output.pos);
+            total += output.pos;
+            isFull = (output.pos == output.size);
+        } while (input.pos < input.size || isFull);
+    }
+    if (last)
+        error::raise({{"msg", "Compressed data is truncated"}});
+    return total;
+}
+
+qint64 contentSize(QIODevice &src, bool isDecoded)
+{
+    // max frame header size
+    auto header = src.peek(18);
+    auto size = ZSTD_getFrameContentSize(header.constData(), header.size());
+    if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR)
+        return size;
+
+    // compressed w/o size in the header
+    if (!isDecoded)
+        return -1;
+    Sink sink;
+    sink.open(QIODevice::WriteOnly);
+    return decompress(src, sink);
+}
+
+#else // VAULT_HAVE_ZSTD
+
+bool isAvailable()
+{
+    return false;
+}
+
+void compress(QIODevice &, QIODevice &, int, int)
+{
+    error::raise({{"msg", "Vault is built without compression support"}});
+}
+
+qint64 decompress(QIODevice &, QIODevice &)
+{
+    error::raise({{"msg", "Vault is built without compression support"}});
+    return 0;
+}
+
+qint64 contentSize(QIODevice &, bool)
+{
+    error::raise({{"msg", "Vault is built without compression support"}});
+    return 0;
+}
+
+#endif // VAULT_HAVE_ZSTD
+
+}}
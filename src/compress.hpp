@@ -0,0 +1,38 @@
+#ifndef _VAULT_COMPRESS_HPP_
+#define _VAULT_COMPRESS_HPP_
+/**
+ * @file compress.hpp
+ * @brief Blob compression (zstd)
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+
+class QIODevice;
+
+namespace vault { namespace compress {
+
+/// false if vault is built without zstd
+bool isAvailable();
+
+/**
+ * Fast probe: file is not worth compressing if it has a signature of
+ * already compressed format (jpeg, mp4, zip etc.) or the sample of
+ * its data has high entropy
+ */
+bool isCompressible(QString const &path);
+
+/// stream compression, threads > 0 enables multi-threaded zstd mode
+void compress(QIODevice &src, QIODevice &dst, int level, int threads = 0);
+/// stream decompression, returns size of decompressed data
+qint64 decompress(QIODevice &src, QIODevice &dst);
+/// size of decompressed data, it is read from the frame header if
+/// it was recorded there, otherwise data is decompressed or -1 is
+/// returned if isDecoded is false
+qint64 contentSize(QIODevice &src, bool isDecoded = true);
+
+}}
+
+#endif // _VAULT_COMPRESS_HPP_
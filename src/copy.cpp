@@ -0,0 +1,321 @@
+/**
+ * @file copy.cpp
+ * @brief Files copying using the cheapest method supported by fs
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "copy.hpp"
+#include <vault/progress.hpp>
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QHash>
+#include <QPair>
+
+#include <mutex>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace copy {
+
+namespace {
+
+const size_t bufferSize = 128 * 1024;
+
+enum Caps { NoClone = 1, NoCopyRange = 2 };
+
+// what is not supported for (src device, dst device) pair
+std::mutex capsMutex;
+QHash<QPair<quint64, quint64>, int> caps;
+
+int getCaps(QPair<quint64, quint64> const &key)
+{
+    std::lock_guard<std::mutex> lock(capsMutex);
+    return caps.value(key, 0);
+}
+
+void disable(QPair<quint64, quint64> const &key, Caps cap)
+{
+    std::lock_guard<std::mutex> lock(capsMutex);
+    caps[key] |= cap;
+}
+
+class Fd
+{
+public:
+    Fd(int fd) : fd_(fd) {}
+    ~Fd() { if (fd_ >= 0) ::close(fd_); }
+    operator int() const { return fd_; }
+private:
+    Fd(Fd const &);
+    Fd &operator =(Fd const &);
+    int fd_;
+};
+
+void raiseErrno(char const *msg, QString const &src, QString const &dst)
+{
+    error::raise({{"msg", msg}, {"src", src}, {"dst", dst}
+            , {"error", QString::fromLocal8Bit(::strerror(errno))}});
+}
+
+bool isUnsupported(int err)
+{
+    return err == EXDEV || err == EOPNOTSUPP || err == ENOTTY
+        || err == EINVAL || err == ENOSYS || err == EBADF;
+}
+
+bool copyRange(int in, int out, off_t size)
+{
+#ifdef SYS_copy_file_range
+    loff_t inOff = 0, outOff = 0;
+    while (outOff < size) {
+        auto len = ::syscall(SYS_copy_file_range, in, &inOff, out, &outOff
+                             , size_t(size - outOff), 0u);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            return false;
+        if (!len) {
+            // source is shrunk, it is not the reason to stop using
+            // copy_file_range for this devices
+            errno = EIO;
+            return false;
+        }
+    }
+    return true;
+#else
+    (void)in; (void)out; (void)size;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+bool readWrite(int in, int out)
+{
+    QByteArray buf(bufferSize, Qt::Uninitialized);
+    off_t pos = 0;
+    while (true) {
+        auto len = ::pread(in, buf.data(), bufferSize, pos);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            return false;
+        if (!len)
+            return true;
+        for (ssize_t done = 0; done < len;) {
+            auto written = ::pwrite(out, buf.constData() + done, len - done, pos + done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            done += written;
+        }
+        pos += len;
+    }
+}
+
+void preserve(int out, struct stat const &st)
+{
+    ::fchmod(out, st.st_mode & 07777);
+    // ownership can be changed only by privileged user, ignore errors
+    if (::fchown(out, st.st_uid, st.st_gid)) {}
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    ::futimens(out, times);
+}
+
+// symlinks are compared by own mtime if follow is false
+bool isNewer(struct stat const &src, QString const &dst, bool follow = true)
+{
+    struct stat st;
+    auto dstName = QFile::encodeName(dst);
+    auto rc = follow ? ::stat(dstName.constData(), &st)
+        : ::lstat(dstName.constData(), &st);
+    if (rc)
+        return true;
+    return src.st_mtim.tv_sec > st.st_mtim.tv_sec
+        || (src.st_mtim.tv_sec == st.st_mtim.tv_sec
+            && src.st_mtim.tv_nsec > st.st_mtim.tv_nsec);
+}
+
+void copyEntry(QString const &src, QString const &dst, int flags
+               , progress::Reporter *reporter);
+
+}
+
+Method file(QString const &src, QString const &dstPath, int flags
+            , progress::Reporter *reporter)
+{
+    auto dst = dstPath;
+    if (os::path::isDir(dst))
+        dst = os::path::join(dst, QFileInfo(src).fileName());
+
+    Fd in(::open(QFile::encodeName(src).constData(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (in < 0 || ::fstat(in, &st))
+        raiseErrno("Can't open source", src, dst);
+    if ((flags & Update) && !isNewer(st, dst)) {
+        if (reporter)
+            reporter->add(1, st.st_size);
+        return Method::Skip;
+    }
+
+    auto dstName = QFile::encodeName(dst);
+    int fd = ::open(dstName.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 && (flags & Force)) {
+        ::unlink(dstName.constData());
+        fd = ::open(dstName.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    Fd out(fd);
+    struct stat dstSt;
+    if (out < 0 || ::fstat(out, &dstSt))
+        raiseErrno("Can't open destination", src, dst);
+
+    auto key = qMakePair(quint64(st.st_dev), quint64(dstSt.st_dev));
+    auto unsupported = getCaps(key);
+    auto method = Method::ReadWrite;
+
+    if (!(unsupported & NoClone)) {
+        if (!::ioctl(out, FICLONE, int(in))) {
+            method = Method::Clone;
+        } else if (isUnsupported(errno)) {
+            debug::debug("Reflinks are not supported for", src, "->", dst);
+            disable(key, NoClone);
+        }
+    }
+    if (method == Method::ReadWrite && !(unsupported & NoCopyRange)) {
+        if (copyRange(in, out, st.st_size)) {
+            method = Method::CopyRange;
+        } else {
+            if (isUnsupported(errno))
+                disable(key, NoCopyRange);
+            // start from scratch after partial copy
+            if (::ftruncate(out, 0))
+                raiseErrno("Can't truncate destination", src, dst);
+        }
+    }
+    if (method == Method::ReadWrite && !readWrite(in, out))
+        raiseErrno("Can't copy", src, dst);
+
+    if (flags & Preserve)
+        preserve(out, st);
+    if (reporter)
+        reporter->add(1, st.st_size);
+    return method;
+}
+
+namespace {
+
+void copyEntry(QString const &src, QString const &dst, int flags
+               , progress::Reporter *reporter)
+{
+    QFileInfo info(src);
+    if (info.isSymLink() && !(flags & Deref)) {
+        // keep link target as is, QFileInfo returns resolved one
+        QByteArray target(PATH_MAX, '\0');
+        auto len = ::readlink(QFile::encodeName(src).constData()
+                              , target.data(), target.size());
+        if (len < 0)
+            raiseErrno("Can't read symlink", src, dst);
+        target.truncate(len);
+        struct stat srcSt;
+        if (::lstat(QFile::encodeName(src).constData(), &srcSt))
+            raiseErrno("Can't stat", src, dst);
+        auto dstName = QFile::encodeName(dst);
+        struct stat st;
+        if (!::lstat(dstName.constData(), &st)) {
+            if ((flags & Update) && !isNewer(srcSt, dst, false))
+                return;
+            ::unlink(dstName.constData());
+        }
+        if (::symlink(target.constData(), dstName.constData()))
+            raiseErrno("Can't create symlink", src, dst);
+        if (flags & Preserve) {
+            struct timespec times[2] = { srcSt.st_atim, srcSt.st_mtim };
+            ::utimensat(AT_FDCWD, dstName.constData(), times, AT_SYMLINK_NOFOLLOW);
+        }
+        return;
+    }
+
+    if (info.isDir()) {
+        struct stat st;
+        auto srcName = QFile::encodeName(src);
+        if (::stat(srcName.constData(), &st))
+            raiseErrno("Can't stat", src, dst);
+        if (!os::path::isDir(dst) && !QDir().mkpath(dst))
+            raiseErrno("Can't create dir", src, dst);
+
+        QDir dir(src);
+        for (auto const &name : dir.entryList(QDir::AllEntries | QDir::Hidden
+                                              | QDir::System | QDir::NoDotAndDotDot))
+            copyEntry(dir.filePath(name), os::path::join(dst, name), flags, reporter);
+
+        if (flags & Preserve) {
+            auto dstName = QFile::encodeName(dst);
+            ::chmod(dstName.constData(), st.st_mode & 07777);
+            struct timespec times[2] = { st.st_atim, st.st_mtim };
+            ::utimensat(AT_FDCWD, dstName.constData(), times, 0);
+        }
+    } else if (info.isFile()) {
+        file(src, dst, flags, reporter);
+    } else {
+        debug::warning("Skipping special file", src);
+    }
+}
+
+}
+
+void tree(QString const &src, QString const &dstDir, int flags
+          , progress::Reporter *reporter)
+{
+    QFileInfo info(src);
+    auto name = info.fileName();
+    // "<dir>/." - contents of the dir
+    auto dst = (name == "." || name.isEmpty()) ? dstDir : os::path::join(dstDir, name);
+    copyEntry(src, dst, flags, reporter);
+}
+
+Size size(QString const &src, int flags)
+{
+    Size res;
+    QFileInfo info(src);
+    if (info.isSymLink() && !(flags & Deref))
+        return res;
+    if (info.isDir()) {
+        QDir dir(src);
+        for (auto const &name : dir.entryList(QDir::AllEntries | QDir::Hidden
+                                              | QDir::System | QDir::NoDotAndDotDot)) {
+            auto child = size(dir.filePath(name), flags);
+            res.files += child.files;
+            res.bytes += child.bytes;
+        }
+    } else if (info.isFile()) {
+        res.files = 1;
+        res.bytes = info.size();
+    }
+    return res;
+}
+
+}}
@@ -0,0 +1,59 @@
+#ifndef _VAULT_COPY_HPP_
+#define _VAULT_COPY_HPP_
+/**
+ * @file copy.hpp
+ * @brief Files copying using the cheapest method supported by fs
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+
+namespace vault {
+
+namespace progress { class Reporter; }
+
+namespace copy {
+
+enum class Method { Clone, CopyRange, ReadWrite, Skip };
+
+enum Flags {
+    Preserve = 1 << 0, // mode, ownership (if possible), timestamps
+    Update = 1 << 1,   // copy only if destination is older or absent
+    Deref = 1 << 2,    // follow symlinks in the source tree
+    Force = 1 << 3     // replace destination if it can't be opened
+};
+
+/**
+ * Copy regular file. If dst is a directory file is copied into
+ * it. Data is cloned (FICLONE) if both files are on the same fs
+ * supporting reflinks, otherwise copy_file_range is tried and the
+ * last resort is read/write. Support is detected once for each pair
+ * of devices. Copied (or skipped) file is added to the progress.
+ */
+Method file(QString const &src, QString const &dst, int flags = Preserve
+            , progress::Reporter *reporter = nullptr);
+
+/**
+ * Recursive copy: src is copied into dstDir like "cp -r" does
+ * ("<dir>/." means contents of the dir). Symlinks are copied as
+ * symlinks unless Deref flag is set.
+ */
+void tree(QString const &src, QString const &dstDir, int flags = Preserve
+          , progress::Reporter *reporter = nullptr);
+
+struct Size
+{
+    Size() : files(0), bytes(0) {}
+    qint64 files;
+    qint64 bytes;
+};
+
+/// count and size of regular files tree() copies from src, used as
+/// the progress total
+Size size(QString const &src, int flags = Preserve);
+
+}}
+
+#endif // _VAULT_COPY_HPP_
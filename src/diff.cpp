@@ -0,0 +1,267 @@
+/**
+ * @file diff.cpp
+ * @brief Streaming diff of units trees
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "diff.hpp"
+#include "hash.hpp"
+
+#include <qtaround/os.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+
+#include <limits.h>
+#include <unistd.h>
+
+namespace os = qtaround::os;
+
+namespace vault {
+
+namespace diff {
+
+namespace {
+
+typedef Snapshot::Entry Entry;
+
+class SnapshotTree : public Tree
+{
+public:
+    SnapshotTree(QString const &repo, QString const &tag)
+        : m_trees(browse::Trees::get(repo))
+        , m_tag(tag)
+    {}
+
+    QStringList units()
+    {
+        QStringList res;
+        for (auto const &e : m_trees->entries(m_trees->stat(m_tag, QString()).sha)) {
+            // .units.json, .message etc. are not units
+            if (e.isDir() && !e.name.startsWith('.'))
+                res << e.name;
+        }
+        return res;
+    }
+
+    Entry unit(QString const &name)
+    {
+        auto res = m_trees->stat(m_tag, name);
+        return res.isDir() ? res : Entry();
+    }
+
+    browse::Entries entries(Entry const &dir, QString const &)
+    {
+        return m_trees->entries(dir.sha);
+    }
+
+private:
+    std::shared_ptr<browse::Trees> m_trees;
+    QString m_tag;
+};
+
+class DirTree : public Tree
+{
+public:
+    DirTree(QString const &root) : m_root(root) {}
+
+    QStringList units()
+    {
+        return QDir(m_root).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    }
+
+    Entry unit(QString const &name)
+    {
+        Entry res;
+        if (os::path::isDir(os::path::join(m_root, name))) {
+            res.name = name;
+            res.type = Entry::Type::Dir;
+        }
+        return res;
+    }
+
+    browse::Entries entries(Entry const &, QString const &path)
+    {
+        browse::Entries res;
+        QStringList files;
+        QList<int> filePos;
+        auto dir = os::path::join(m_root, path);
+        auto infos = QDir(dir).entryInfoList
+            (QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+        for (auto const &info : infos) {
+            Entry e;
+            e.name = info.fileName();
+            if (info.isSymLink()) {
+                // git stores link target as the blob
+                QByteArray target(PATH_MAX, '\0');
+                auto len = ::readlink(QFile::encodeName(info.absoluteFilePath()).constData()
+                                      , target.data(), target.size());
+                target.truncate(len > 0 ? len : 0);
+                e.type = Entry::Type::SymLink;
+                e.target = QString::fromUtf8(target);
+                e.size = target.size();
+                e.sha = hash::blob(target.constData(), target.size());
+            } else if (info.isDir()) {
+                e.type = Entry::Type::Dir;
+            } else {
+                e.type = Entry::Type::File;
+                e.size = info.size();
+                files << info.absoluteFilePath();
+                filePos << res.size();
+            }
+            res.push_back(e);
+        }
+        auto shas = hash::blobs(files);
+        for (int i = 0; i < files.size(); ++i)
+            res[filePos[i]].sha = shas.value(files[i]);
+        std::sort(res.begin(), res.end(), [](Entry const &a, Entry const &b) {
+                return a.name < b.name;
+            });
+        return res;
+    }
+
+private:
+    QString m_root;
+};
+
+}
+
+std::unique_ptr<Tree> snapshotTree(QString const &repo, QString const &tag)
+{
+    return std::unique_ptr<Tree>(new SnapshotTree(repo, tag));
+}
+
+std::unique_ptr<Tree> dirTree(QString const &root)
+{
+    return std::unique_ptr<Tree>(new DirTree(root));
+}
+
+}
+
+Diff::Data::Data(std::unique_ptr<diff::Tree> from, std::unique_ptr<diff::Tree> to
+                 , QStringList const &units)
+    : m_from(std::move(from))
+    , m_to(std::move(to))
+    , m_units(units)
+    , m_unit(0)
+{
+    if (m_units.isEmpty()) {
+        m_units = m_from->units() + m_to->units();
+        m_units.sort();
+        m_units.removeDuplicates();
+    }
+}
+
+Diff::Data::~Data()
+{
+    if (!m_scratch.isEmpty())
+        os::rmtree(m_scratch);
+}
+
+bool Diff::Data::next(Change &res)
+{
+    typedef Snapshot::Entry Entry;
+    auto isSame = [](Entry const &a, Entry const &b) {
+        return a.isValid() && b.isValid() && a.isDir() == b.isDir()
+        && !a.sha.isEmpty() && a.sha == b.sha;
+    };
+    while (true) {
+        if (m_frames.isEmpty()) {
+            if (m_unit >= m_units.size())
+                return false;
+            auto name = m_units[m_unit++];
+            auto a = m_from->unit(name);
+            auto b = m_to->unit(name);
+            // unchanged unit tree
+            if (isSame(a, b))
+                continue;
+            Frame frame;
+            frame.unit = name;
+            if (a.isValid())
+                frame.fromEntries = m_from->entries(a, name);
+            if (b.isValid())
+                frame.toEntries = m_to->entries(b, name);
+            m_frames.push_back(frame);
+            continue;
+        }
+
+        auto &frame = m_frames.last();
+        auto hasFrom = frame.from < frame.fromEntries.size();
+        auto hasTo = frame.to < frame.toEntries.size();
+        if (!hasFrom && !hasTo) {
+            m_frames.removeLast();
+            continue;
+        }
+        int cmp = !hasFrom ? 1 : !hasTo ? -1
+            : QString::compare(frame.fromEntries[frame.from].name
+                               , frame.toEntries[frame.to].name);
+        Entry a, b;
+        if (cmp <= 0)
+            a = frame.fromEntries[frame.from++];
+        if (cmp >= 0)
+            b = frame.toEntries[frame.to++];
+        if (isSame(a, b))
+            continue;
+
+        auto unit = frame.unit;
+        auto path = frame.prefix + (a.isValid() ? a.name : b.name);
+        res = Change();
+        res.unit = unit;
+        res.path = path;
+        if (a.isDir() || b.isDir()) {
+            // dir contents are compared later, file replaced by dir
+            // (or vice versa) is reported now
+            Frame child;
+            child.unit = unit;
+            child.prefix = path + "/";
+            auto fullPath = os::path::join(unit, path);
+            if (a.isDir())
+                child.fromEntries = m_from->entries(a, fullPath);
+            if (b.isDir())
+                child.toEntries = m_to->entries(b, fullPath);
+            m_frames.push_back(child);
+            if (!a.isDir() && a.isValid()) {
+                res.type = Change::Type::Removed;
+                res.oldSize = a.size;
+                return true;
+            }
+            if (!b.isDir() && b.isValid()) {
+                res.type = Change::Type::Added;
+                res.newSize = b.size;
+                return true;
+            }
+            continue;
+        }
+        res.type = !a.isValid() ? Change::Type::Added
+            : !b.isValid() ? Change::Type::Removed : Change::Type::Modified;
+        res.oldSize = a.isValid() ? a.size : -1;
+        res.newSize = b.isValid() ? b.size : -1;
+        return true;
+    }
+}
+
+Diff::Diff(Data *data)
+    : m(data)
+{
+}
+
+Diff::Diff(Diff &&from)
+    : m(std::move(from.m))
+{
+}
+
+Diff::~Diff()
+{
+}
+
+bool Diff::next(Change &change)
+{
+    return m && m->next(change);
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef _VAULT_DIFF_HPP_
+#define _VAULT_DIFF_HPP_
+/**
+ * @file diff.hpp
+ * @brief Streaming diff of units trees
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "browse.hpp"
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include <memory>
+
+namespace vault { namespace diff {
+
+/**
+ * Units tree compared by Diff. Entries are matched by name, entries
+ * with the same non-empty sha are equal (dirs are not descended),
+ * blobs are identified by the blob sha, so contents of the blob
+ * storage is never read.
+ */
+class Tree
+{
+public:
+    virtual ~Tree() {}
+
+    /// names of all units in the tree
+    virtual QStringList units() = 0;
+    /// root dir of the unit, invalid if there is no such unit
+    virtual Snapshot::Entry unit(QString const &name) = 0;
+    /// entries of the dir sorted by name, path is relative to the tree
+    /// root
+    virtual browse::Entries entries(Snapshot::Entry const &dir, QString const &path) = 0;
+};
+
+/// units trees of the snapshot tag
+std::unique_ptr<Tree> snapshotTree(QString const &repo, QString const &tag);
+/// units trees exported into root/<unit>, file shas are calculated
+/// by hashing, dirs have no sha
+std::unique_ptr<Tree> dirTree(QString const &root);
+
+}
+
+struct Diff::Data
+{
+    Data(std::unique_ptr<diff::Tree> from, std::unique_ptr<diff::Tree> to
+         , QStringList const &units);
+    ~Data();
+
+    bool next(Change &);
+
+    // pending dir comparison
+    struct Frame
+    {
+        Frame() : from(0), to(0) {}
+        QString unit;
+        QString prefix;
+        browse::Entries fromEntries;
+        browse::Entries toEntries;
+        int from;
+        int to;
+    };
+
+    std::unique_ptr<diff::Tree> m_from;
+    std::unique_ptr<diff::Tree> m_to;
+    QStringList m_units;
+    int m_unit;
+    QList<Frame> m_frames;
+    /// removed with the diff
+    QString m_scratch;
+};
+
+}
+
+#endif // _VAULT_DIFF_HPP_
@@ -0,0 +1,142 @@
+/**
+ * @file fingerprint.cpp
+ * @brief Cheap fingerprints of units inputs
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "fingerprint.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDirIterator>
+#include <QCryptographicHash>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace os = qtaround::os;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace fingerprint {
+
+namespace {
+
+struct Summary
+{
+    Summary() : count(0), size(0), mtime(0) {}
+
+    void add(QString const &path)
+    {
+        struct stat st;
+        if (::lstat(QFile::encodeName(path).constData(), &st))
+            return;
+        ++count;
+        if (!S_ISDIR(st.st_mode))
+            size += st.st_size;
+        // dir mtime is changed on entries addition/removal/renaming
+        auto ns = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        if (ns > mtime)
+            mtime = ns;
+    }
+
+    qint64 count;
+    qint64 size;
+    qint64 mtime;
+};
+
+QByteArray fromCommand(QString const &home, QString const &name, QString const &command
+                       , script::Options options)
+{
+    options.workingDirectory = home;
+    // output is the fingerprint, not progress
+    options.onProgress = nullptr;
+    auto ps = script::run(name + ".fingerprint", "sh", {"-c", command}, options);
+    options.cancel.check();
+    if (ps.rc || ps.isTimedOut) {
+        debug::warning("Fingerprint command failed", command, "rc", ps.rc
+                       , "timed out", ps.isTimedOut);
+        return QByteArray();
+    }
+    auto out = ps.out.trimmed();
+    return out.isEmpty() ? out : "cmd " + out;
+}
+
+}
+
+QByteArray compute(QString const &home, config::Unit const &unit
+                   , script::Options const &options)
+{
+    if (!unit.isIncremental())
+        return QByteArray();
+
+    QByteArray res;
+    auto command = unit.fingerprintCommand();
+    if (!command.isEmpty()) {
+        res = fromCommand(home, unit.name(), command, options);
+    } else {
+        auto inputs = unit.inputs();
+        if (inputs.isEmpty())
+            return QByteArray();
+
+        Summary summary;
+        for (auto const &input : inputs) {
+            auto path = os::path::join(home, input);
+            summary.add(path);
+            if (!os::path::isDir(path))
+                continue;
+            QDirIterator it(path, QDir::AllEntries | QDir::Hidden | QDir::System
+                            | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+            while (it.hasNext())
+                summary.add(it.next());
+        }
+        res = QByteArray("stat ") + QByteArray::number(summary.count)
+            + ' ' + QByteArray::number(summary.size)
+            + ' ' + QByteArray::number(summary.mtime)
+            + ' ' + inputs.join(':').toUtf8();
+    }
+    if (res.isEmpty())
+        return res;
+
+    // changed unit script can export data differently
+    Summary script;
+    script.add(unit.script());
+    res += ' ' + unit.script().toUtf8() + ' ' + QByteArray::number(script.size)
+        + ' ' + QByteArray::number(script.mtime);
+    return QCryptographicHash::hash(res, QCryptographicHash::Sha1).toHex();
+}
+
+Store::Store(QString const &fname)
+    : m_fname(fname)
+{
+}
+
+void Store::load()
+{
+    QFile file(m_fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    while (!file.atEnd()) {
+        auto line = file.readLine().trimmed();
+        auto sep = line.indexOf(' ');
+        if (sep <= 0)
+            continue;
+        m_data[QString::fromUtf8(line.mid(sep + 1))] = line.left(sep);
+    }
+}
+
+bool Store::save() const
+{
+    QSaveFile file(m_fname);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    for (auto it = m_data.begin(); it != m_data.end(); ++it)
+        file.write(it.value() + ' ' + it.key().toUtf8() + '\n');
+    return file.commit();
+}
+
+}}
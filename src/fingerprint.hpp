@@ -0,0 +1,53 @@
+#ifndef _VAULT_FINGERPRINT_HPP_
+#define _VAULT_FINGERPRINT_HPP_
+/**
+ * @file fingerprint.hpp
+ * @brief Cheap fingerprints of units inputs
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <vault/config.hpp>
+#include "script.hpp"
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+
+namespace vault { namespace fingerprint {
+
+/**
+ * Fingerprint of the unit inputs: output of the unit fingerprint
+ * command if it is set, otherwise count, total size and max mtime of
+ * all files and dirs under input paths plus the unit script
+ * identity. Empty fingerprint means unit should be always exported
+ * (it is not incremental or there are no inputs declared). Command is
+ * run with the unit script options (timeout, cancellation etc.),
+ * raises if it is cancelled.
+ */
+QByteArray compute(QString const &home, config::Unit const &unit
+                   , script::Options const &options = script::Options());
+
+/// fingerprints of units saved after the last successful backup,
+/// stored as "<fingerprint> <unit>" lines
+class Store
+{
+public:
+    explicit Store(QString const &fname);
+
+    void load();
+    bool save() const;
+
+    inline QByteArray get(QString const &unit) const { return m_data.value(unit); }
+    inline void set(QString const &unit, QByteArray const &v) { m_data[unit] = v; }
+    inline void remove(QString const &unit) { m_data.remove(unit); }
+
+private:
+    QString m_fname;
+    QMap<QString, QByteArray> m_data;
+};
+
+}}
+
+#endif // _VAULT_FINGERPRINT_HPP_
@@ -0,0 +1,217 @@
+/**
+ * @file gc.cpp
+ * @brief Blob storage garbage collection
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "gc.hpp"
+#include "blobs.hpp"
+#include "git.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QElapsedTimer>
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace blobs {
+
+namespace {
+
+// fan-out dirs of blobs are swept first, then dirs of chunks and
+// the last step is pruning of packs
+const int fanOutCount = 256;
+const int packsStep = 2 * fanOutCount;
+const int sweepEnd = packsStep + 1;
+
+QString fanOutName(int i)
+{
+    return QString("%1").arg(i % fanOutCount, 2, 16, QChar('0'));
+}
+
+QSet<QByteArray> readSet(QString const &fname)
+{
+    QSet<QByteArray> res;
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return res;
+    while (!file.atEnd()) {
+        auto line = file.readLine().trimmed();
+        if (!line.isEmpty())
+            res.insert(line);
+    }
+    return res;
+}
+
+bool appendSet(QString const &fname, QSet<QByteArray> const &data)
+{
+    QFile file(fname);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    for (auto const &v : data)
+        file.write(v + '\n');
+    return true;
+}
+
+}
+
+QSet<QByteArray> referenced(QString const &repo, QByteArray const &treeish)
+{
+    QList<QByteArray> links;
+    QSet<QByteArray> seen;
+    for (auto const &e : git::lsTree(repo, treeish)) {
+        if (e.isSymLink() && !seen.contains(e.sha)) {
+            seen.insert(e.sha);
+            links.push_back(e.sha);
+        }
+    }
+
+    QSet<QByteArray> res;
+    for (auto const &target : git::catFiles(repo, links)) {
+        // blob links are pointing to .git/blobs/<2>/<38>
+        if (!target.contains(".git/blobs/"))
+            continue;
+        auto sha = Storage::shaOf(QString::fromUtf8(target));
+        if (!sha.isEmpty())
+            res.insert(sha);
+    }
+    return res;
+}
+
+Collector::Collector(QString const &repo, Storage &storage)
+    : m_repo(repo)
+    , m_storage(storage)
+    , m_cursor(0)
+    , m_removed(0)
+    , m_freed(0)
+{
+}
+
+QString Collector::statePath(QString const &name) const
+{
+    return os::path::join(m_repo, ".git", "vault.gc", name);
+}
+
+void Collector::load()
+{
+    auto dir = statePath("");
+    if (!os::path::isDir(dir)) {
+        if (!os::mkdir(dir, {{"parent", true}}))
+            error::raise({{"msg", "Can't create gc state dir"}, {"path", dir}});
+        m_cursor = 0;
+        return;
+    }
+    m_roots = readSet(statePath("roots"));
+    m_live = readSet(statePath("live"));
+    m_liveChunks = readSet(statePath("chunks"));
+    m_cursor = QString::fromUtf8(os::read_file(statePath("cursor"))).toInt();
+    debug::info("Continue gc from", m_cursor, "marked roots", m_roots.size());
+}
+
+void Collector::save()
+{
+    QSaveFile file(statePath("cursor"));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QByteArray::number(m_cursor)) < 0
+        || !file.commit())
+        error::raise({{"msg", "Can't save gc state"}, {"path", statePath("cursor")}});
+}
+
+void Collector::mark(QByteArray const &root)
+{
+    debug::debug("GC: mark", root);
+    QSet<QByteArray> live, chunks;
+    for (auto const &sha : referenced(m_repo, root)) {
+        if (m_live.contains(sha))
+            continue;
+        live.insert(sha);
+        auto manifest = m_storage.manifestPath(sha);
+        if (!os::path::isFile(manifest))
+            continue;
+        for (auto const &chunk : Manifest::read(manifest).chunks) {
+            if (!m_liveChunks.contains(chunk.sha))
+                chunks.insert(chunk.sha);
+        }
+    }
+    if (!appendSet(statePath("live"), live)
+        || !appendSet(statePath("chunks"), chunks)
+        || !appendSet(statePath("roots"), {root}))
+        error::raise({{"msg", "Can't save gc mark state"}});
+    m_live.unite(live);
+    m_liveChunks.unite(chunks);
+    m_roots.insert(root);
+}
+
+void Collector::sweep(int cursor)
+{
+    if (cursor == packsStep) {
+        m_freed += m_storage.prunePacks(m_live);
+        return;
+    }
+
+    auto isChunks = cursor >= fanOutCount;
+    auto name = fanOutName(cursor);
+    auto root = isChunks ? os::path::join(m_storage.root(), "chunks") : m_storage.root();
+    QDir dir(os::path::join(root, name));
+    if (!dir.exists())
+        return;
+
+    auto const &live = isChunks ? m_liveChunks : m_live;
+    for (auto const &info : dir.entryInfoList(QDir::Files | QDir::Hidden | QDir::System)) {
+        auto sha = (name + info.completeBaseName()).toLatin1();
+        if (live.contains(sha))
+            continue;
+        debug::debug("GC: remove", info.filePath());
+        m_freed += info.size();
+        ++m_removed;
+        if (!QFile::remove(info.filePath()))
+            debug::warning("GC: can't remove", info.filePath());
+    }
+    QDir().rmdir(dir.absolutePath());
+}
+
+bool Collector::run(int budget)
+{
+    QElapsedTimer timer;
+    timer.start();
+    auto isExhausted = [budget, &timer]() {
+        return budget >= 0 && timer.elapsed() >= budget;
+    };
+
+    load();
+    // new roots could appear since the previous run, they are marked
+    // first because sweeping is only valid for the complete live set
+    auto roots = git::roots(m_repo);
+    for (auto const &root : roots) {
+        if (m_roots.contains(root))
+            continue;
+        if (isExhausted())
+            return false;
+        mark(root);
+    }
+
+    while (m_cursor < sweepEnd) {
+        if (isExhausted()) {
+            debug::info("GC: budget is exhausted at", m_cursor);
+            return false;
+        }
+        sweep(m_cursor++);
+        save();
+    }
+
+    debug::info("GC: removed", m_removed, "files, freed", m_freed, "bytes");
+    os::rmtree(statePath(""));
+    return true;
+}
+
+}}
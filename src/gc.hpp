@@ -0,0 +1,60 @@
+#ifndef _VAULT_GC_HPP_
+#define _VAULT_GC_HPP_
+/**
+ * @file gc.hpp
+ * @brief Blob storage garbage collection
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QByteArray>
+#include <QSet>
+
+namespace vault { namespace blobs {
+
+class Storage;
+
+/// shas of all blobs symlinked from the tree
+QSet<QByteArray> referenced(QString const &repo, QByteArray const &treeish);
+
+/**
+ * Mark and sweep collector of blobs not referenced from any snapshot
+ * tag, dead blobs are also dropped from packs. State is saved after
+ * each step (root marked, fan-out dir swept) into .git/vault.gc, so
+ * collection can be interrupted and continued later. Roots appeared
+ * since last run are marked before sweeping is continued.
+ */
+class Collector
+{
+public:
+    Collector(QString const &repo, Storage &storage);
+
+    /// perform steps until done or budget (ms) is exhausted, budget < 0
+    /// means no limit. Returns true when collection is completed
+    bool run(int budget = -1);
+
+    inline int removed() const { return m_removed; }
+    inline qint64 freed() const { return m_freed; }
+
+private:
+    void load();
+    void save();
+    void mark(QByteArray const &root);
+    void sweep(int dir);
+    QString statePath(QString const &name) const;
+
+    QString m_repo;
+    Storage &m_storage;
+    QSet<QByteArray> m_roots;
+    QSet<QByteArray> m_live;
+    QSet<QByteArray> m_liveChunks;
+    int m_cursor;
+    int m_removed;
+    qint64 m_freed;
+};
+
+}}
+
+#endif // _VAULT_GC_HPP_
@@ -0,0 +1,350 @@
+/**
+ * @file git.cpp
+ * @brief Helpers for git operations not covered by gittin
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "git.hpp"
+
+#include <qtaround/subprocess.hpp>
+#include <qtaround/debug.hpp>
+#include <qtaround/error.hpp>
+
+#include <QProcess>
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+
+namespace subprocess = qtaround::subprocess;
+namespace debug = qtaround::debug;
+namespace error = qtaround::error;
+
+namespace vault { namespace git {
+
+QString config(QString const &repo, QString const &key
+               , QString const &defaultValue)
+{
+    subprocess::Process ps;
+    ps.setWorkingDirectory(repo);
+    ps.start("git", {"config", "--get", key});
+    ps.wait(-1);
+    // rc == 1 means there is no such key
+    if (ps.rc())
+        return defaultValue;
+    return QString::fromUtf8(ps.stdout()).trimmed();
+}
+
+qint64 parseSize(QString v, bool *ok)
+{
+    // git-style size suffixes
+    qint64 multiplier = 1;
+    auto suffix = v.right(1).toLower();
+    if (suffix == "k")
+        multiplier = 1024;
+    else if (suffix == "m")
+        multiplier = 1024 * 1024;
+    else if (suffix == "g")
+        multiplier = 1024 * 1024 * 1024;
+    if (multiplier != 1)
+        v.chop(1);
+
+    return v.toLongLong(ok) * multiplier;
+}
+
+qint64 config(QString const &repo, QString const &key, qint64 defaultValue)
+{
+    auto v = config(repo, key);
+    if (v.isEmpty())
+        return defaultValue;
+
+    bool ok = false;
+    auto res = parseSize(v, &ok);
+    if (!ok) {
+        debug::warning("Invalid numeric git config value", key, v);
+        return defaultValue;
+    }
+    return res;
+}
+
+namespace {
+
+QByteArray run(QString const &repo, QStringList const &args
+               , QByteArray const &input, QString const &indexFile)
+{
+    QProcess ps;
+    ps.setWorkingDirectory(repo);
+    if (!indexFile.isEmpty()) {
+        auto env = QProcessEnvironment::systemEnvironment();
+        env.insert("GIT_INDEX_FILE", indexFile);
+        ps.setProcessEnvironment(env);
+    }
+    ps.start("git", args);
+    if (!ps.waitForStarted(-1))
+        error::raise({{"msg", "Can't start git"}, {"args", args}});
+    if (!input.isEmpty())
+        ps.write(input);
+    ps.closeWriteChannel();
+    ps.waitForFinished(-1);
+    if (ps.exitStatus() != QProcess::NormalExit || ps.exitCode())
+        error::raise({{"msg", "git failed"}, {"args", args}
+                , {"rc", ps.exitCode()}
+                , {"stderr", QString::fromUtf8(ps.readAllStandardError())}});
+    return ps.readAllStandardOutput();
+}
+
+}
+
+QByteArray output(QString const &repo, QStringList const &args
+                  , QByteArray const &input)
+{
+    return run(repo, args, input, QString());
+}
+
+QList<TreeEntry> lsTree(QString const &repo, QString const &treeish
+                        , bool recursive, bool withSizes
+                        , QStringList const &paths)
+{
+    QStringList args = {"ls-tree", "-z"};
+    if (recursive)
+        args << "-r";
+    if (withSizes)
+        args << "-l";
+    args << treeish;
+    if (!paths.isEmpty())
+        args << "--" << paths;
+
+    QList<TreeEntry> res;
+    // <mode> SP <type> SP <sha> [SP+ <size>] TAB <path> NUL
+    for (auto const &line : output(repo, args).split('\0')) {
+        if (line.isEmpty())
+            continue;
+        auto tab = line.indexOf('\t');
+        auto info = line.left(tab).simplified().split(' ');
+        if (tab < 0 || info.size() != (withSizes ? 4 : 3))
+            error::raise({{"msg", "Unexpected ls-tree output"}
+                    , {"line", QString::fromUtf8(line)}});
+        TreeEntry e;
+        e.mode = info[0];
+        e.type = info[1];
+        e.sha = info[2];
+        if (withSizes && info[3] != "-")
+            e.size = info[3].toLongLong();
+        e.path = QString::fromUtf8(line.mid(tab + 1));
+        res.push_back(e);
+    }
+    return res;
+}
+
+QList<QByteArray> catFiles(QString const &repo, QList<QByteArray> const &shas
+                          , bool allowMissing)
+{
+    QList<QByteArray> res;
+    if (shas.isEmpty())
+        return res;
+
+    QByteArray input;
+    for (auto const &sha : shas)
+        input.append(sha).append('\n');
+    auto out = output(repo, {"cat-file", "--batch"}, input);
+
+    // <sha> SP <type> SP <size> LF <contents> LF
+    int pos = 0;
+    for (auto const &sha : shas) {
+        auto eol = out.indexOf('\n', pos);
+        auto header = out.mid(pos, eol - pos).split(' ');
+        if (allowMissing && eol >= 0 && header.size() == 2 && header[1] == "missing") {
+            res.push_back(QByteArray());
+            pos = eol + 1;
+            continue;
+        }
+        if (eol < 0 || header.size() != 3)
+            error::raise({{"msg", "Can't get object"}, {"sha", QString(sha)}});
+        auto size = header[2].toInt();
+        res.push_back(out.mid(eol + 1, size));
+        pos = eol + 1 + size + 1;
+    }
+    return res;
+}
+
+QList<TreeEntry> parseTree(QByteArray const &data)
+{
+    QList<TreeEntry> res;
+    // <mode> SP <name> NUL <20 bytes sha>
+    int pos = 0;
+    while (pos < data.size()) {
+        auto sp = data.indexOf(' ', pos);
+        auto nul = data.indexOf('\0', sp + 1);
+        if (sp < 0 || nul < 0 || nul + 21 > data.size())
+            error::raise({{"msg", "Broken tree object"}});
+        TreeEntry e;
+        e.mode = data.mid(pos, sp - pos);
+        e.type = e.mode == "40000" ? "tree" : (e.mode == "160000" ? "commit" : "blob");
+        e.sha = data.mid(nul + 1, 20).toHex();
+        e.path = QString::fromUtf8(data.mid(sp + 1, nul - sp - 1));
+        res.push_back(e);
+        pos = nul + 21;
+    }
+    return res;
+}
+
+qint64 objectsSize(QString const &repo)
+{
+    qint64 res = 0;
+    // sizes are in KiB
+    for (auto const &line : output(repo, {"count-objects", "-v"}).split('\n')) {
+        auto kv = line.split(':');
+        if (kv.size() == 2 && (kv[0] == "size" || kv[0] == "size-pack"))
+            res += kv[1].trimmed().toLongLong() * 1024;
+    }
+    return res;
+}
+
+QList<QByteArray> roots(QString const &repo)
+{
+    QList<QByteArray> res;
+    auto out = output(repo, {"for-each-ref", "--format=%(objectname) %(*objectname)"
+                , "refs/tags/>*"});
+    for (auto const &line : out.split('\n')) {
+        auto ids = line.trimmed().split(' ');
+        if (ids.isEmpty() || ids[0].isEmpty())
+            continue;
+        // annotated tag is peeled to the commit
+        res.push_back(ids.size() > 1 && !ids[1].isEmpty() ? ids[1] : ids[0]);
+    }
+    return res;
+}
+
+void resetPath(QString const &repo, QString const &treeish, QString const &path)
+{
+    output(repo, {"reset", "-q", treeish, "--", path});
+    // files absent in treeish are untracked now
+    output(repo, {"clean", "-q", "-f", "-d", "-x", "--", path});
+    if (!output(repo, {"ls-tree", "--name-only", treeish, "--", path}).isEmpty())
+        output(repo, {"checkout", "-q", treeish, "--", path});
+}
+
+void checkoutTree(QString const &repo, QString const &tree, QString const &dst)
+{
+    auto dir = QDir(dst).absolutePath();
+    if (!QDir().mkpath(dir))
+        error::raise({{"msg", "Can't create dir"}, {"dir", dir}});
+    // private index, only entries of the tree are checked out
+    auto index = dir + ".index";
+    QFile::remove(index);
+    try {
+        run(repo, {"read-tree", tree}, QByteArray(), index);
+        run(repo, {"checkout-index", "-a", "-f", "--prefix=" + dir + "/"}
+            , QByteArray(), index);
+    } catch (...) {
+        QFile::remove(index);
+        throw;
+    }
+    QFile::remove(index);
+}
+
+ObjectReader::ObjectReader(QString const &repo)
+    : m_repo(repo)
+{
+}
+
+ObjectReader::~ObjectReader()
+{
+    if (m_ps) {
+        m_ps->closeWriteChannel();
+        m_ps->waitForFinished(-1);
+    }
+}
+
+void ObjectReader::waitForData()
+{
+    if (!m_ps->waitForReadyRead(-1))
+        error::raise({{"msg", "git cat-file is finished unexpectedly"}
+                , {"stderr", QString::fromUtf8(m_ps->readAllStandardError())}});
+}
+
+qint64 ObjectReader::read(QByteArray const &name, QIODevice &dst)
+{
+    if (!m_ps) {
+        m_ps.reset(new QProcess());
+        m_ps->setWorkingDirectory(m_repo);
+        m_ps->start("git", {"cat-file", "--batch"});
+        if (!m_ps->waitForStarted(-1))
+            error::raise({{"msg", "Can't start git cat-file"}});
+    }
+    m_ps->write(name + '\n');
+
+    // <sha> SP <type> SP <size> LF <contents> LF
+    while (!m_ps->canReadLine())
+        waitForData();
+    auto header = m_ps->readLine().trimmed().split(' ');
+    if (header.size() != 3)
+        error::raise({{"msg", "Can't read git object"}, {"name", QString(name)}
+                , {"reply", QString(header.join(' '))}});
+
+    auto size = header[2].toLongLong();
+    QByteArray buf;
+    for (auto left = size + 1; left > 0;) {
+        if (!m_ps->bytesAvailable())
+            waitForData();
+        buf = m_ps->read(std::min(left, qint64(64 * 1024)));
+        left -= buf.size();
+        // the last byte is LF after the contents
+        if (!left)
+            buf.chop(1);
+        if (dst.write(buf) != buf.size())
+            error::raise({{"msg", "Can't write git object data"}, {"name", QString(name)}});
+    }
+    return size;
+}
+
+IndexBatch::IndexBatch(QString const &repo)
+    : m_repo(repo)
+{
+}
+
+void IndexBatch::add(QString const &path)
+{
+    m_paths.push_back(path);
+}
+
+void IndexBatch::remove(QString const &path)
+{
+    // --remove drops entries absent in the worktree
+    m_paths.push_back(path);
+}
+
+void IndexBatch::flush()
+{
+    if (m_paths.isEmpty())
+        return;
+    QByteArray input;
+    for (auto const &path : m_paths)
+        input.append(path.toUtf8()).append('\0');
+    debug::debug("Updating index entries:", m_paths.size());
+    auto paths = m_paths;
+    m_paths.clear();
+    try {
+        output(m_repo, {"update-index", "--add", "--remove", "-z", "--stdin"}, input);
+    } catch (error::Error const &e) {
+        // git reports "<path>: <reason>" or "... path <path>"
+        QStringList failed;
+        auto lines = e.m.value("stderr").toString().split('\n');
+        for (auto const &path : paths) {
+            for (auto const &line : lines) {
+                if (line.contains(' ' + path + ':') || line.endsWith(' ' + path)) {
+                    failed << path;
+                    break;
+                }
+            }
+        }
+        auto info = e.m;
+        info["msg"] = "Can't update index";
+        info["paths"] = failed.isEmpty() ? paths : failed;
+        error::raise(info);
+    }
+}
+
+}}
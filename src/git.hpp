@@ -0,0 +1,130 @@
+#ifndef _VAULT_GIT_HPP_
+#define _VAULT_GIT_HPP_
+/**
+ * @file git.hpp
+ * @brief Helpers for git operations not covered by gittin
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+
+#include <memory>
+
+class QProcess;
+class QIODevice;
+
+namespace vault { namespace git {
+
+/// value of the repository configuration option or defaultValue if
+/// it is not set
+QString config(QString const &repo, QString const &key
+               , QString const &defaultValue = QString());
+
+/// number with optional k/m/g suffix
+qint64 parseSize(QString v, bool *ok);
+
+qint64 config(QString const &repo, QString const &key, qint64 defaultValue);
+
+/// run git in the repo, raises on non-zero exit code
+QByteArray output(QString const &repo, QStringList const &args
+                  , QByteArray const &input = QByteArray());
+
+struct TreeEntry
+{
+    TreeEntry() : size(-1) {}
+
+    QByteArray mode;
+    QByteArray type;
+    QByteArray sha;
+    QString path;
+    qint64 size; // object size, only blobs listed withSizes
+
+    inline bool isSymLink() const { return mode == "120000"; }
+    inline bool isTree() const { return type == "tree"; }
+};
+
+/// paths (relative to the repo root) limit listing to these files and
+/// dirs
+QList<TreeEntry> lsTree(QString const &repo, QString const &treeish
+                        , bool recursive = true, bool withSizes = false
+                        , QStringList const &paths = QStringList());
+
+/// contents of the objects (any object names accepted by git), in
+/// the same order. Missing objects are returned as empty if
+/// allowMissing is set, otherwise it raises
+QList<QByteArray> catFiles(QString const &repo, QList<QByteArray> const &shas
+                           , bool allowMissing = false);
+
+/// entries of the raw tree object
+QList<TreeEntry> parseTree(QByteArray const &data);
+
+/// bytes occupied by loose objects and packs
+qint64 objectsSize(QString const &repo);
+
+/// commit shas of all snapshot tags (">*"), master tip is not a root:
+/// it is returned to the newest snapshot before gc
+QList<QByteArray> roots(QString const &repo);
+
+/// return index and worktree of path to the state in treeish, other
+/// paths are not touched
+void resetPath(QString const &repo, QString const &treeish, QString const &path);
+
+/// write files of the tree into dst dir using a temporary index, so
+/// the repo index and worktree are not touched
+void checkoutTree(QString const &repo, QString const &tree, QString const &dst);
+
+/**
+ * Streams objects contents from the single "git cat-file --batch"
+ * process started on the first use, so objects are not loaded into
+ * memory and there is no process per object.
+ */
+class ObjectReader
+{
+public:
+    explicit ObjectReader(QString const &repo);
+    ~ObjectReader();
+
+    /// write object contents into dst, returns its size. Raises if
+    /// there is no such object
+    qint64 read(QByteArray const &name, QIODevice &dst);
+
+private:
+    void waitForData();
+
+    QString m_repo;
+    std::unique_ptr<QProcess> m_ps;
+};
+
+/**
+ * Collects paths to be added to/removed from the index and applies
+ * them by single "git update-index --add --remove" call. Paths are
+ * relative to the repo root.
+ */
+class IndexBatch
+{
+public:
+    explicit IndexBatch(QString const &repo);
+
+    void add(QString const &path);
+    /// path should be already removed from the worktree
+    void remove(QString const &path);
+    /// update index, batch is empty after it. Raises on git error,
+    /// "paths" of the error are paths git failed to process (all
+    /// paths of the batch if they can't be found in the git output)
+    void flush();
+
+    inline int size() const { return m_paths.size(); }
+
+private:
+    QString m_repo;
+    QStringList m_paths;
+};
+
+}}
+
+#endif // _VAULT_GIT_HPP_
@@ -0,0 +1,241 @@
+/**
+ * @file hash.cpp
+ * @brief Git-compatible blob hashing
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "hash.hpp"
+#include <vault/progress.hpp>
+
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QSaveFile>
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <exception>
+
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace hash {
+
+static const int bufferSize = 64 * 1024;
+
+QByteArray blob(QString const &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        error::raise({{"msg", "Can't open blob"}, {"path", path}});
+
+    auto size = file.size();
+    QCryptographicHash sha(QCryptographicHash::Sha1);
+    QByteArray header("blob ");
+    header.append(QByteArray::number(size));
+    header.append('\0');
+    sha.addData(header);
+
+    QByteArray buf(bufferSize, Qt::Uninitialized);
+    qint64 total = 0, len;
+    while ((len = file.read(buf.data(), buf.size())) > 0) {
+        sha.addData(buf.constData(), len);
+        total += len;
+    }
+    if (len < 0 || total != size)
+        error::raise({{"msg", "Blob is changed or can't be read while hashing"}
+                , {"path", path}, {"size", size}, {"read", total}});
+
+    return sha.result().toHex();
+}
+
+QByteArray blob(char const *data, qint64 len)
+{
+    QCryptographicHash sha(QCryptographicHash::Sha1);
+    QByteArray header("blob ");
+    header.append(QByteArray::number(len));
+    header.append('\0');
+    sha.addData(header);
+    sha.addData(data, len);
+    return sha.result().toHex();
+}
+
+QHash<QString, QByteArray> blobs(QStringList const &paths, int threads
+                                 , progress::Reporter *reporter)
+{
+    QHash<QString, QByteArray> res;
+    int count = paths.size();
+    if (!count)
+        return res;
+
+    if (threads <= 0)
+        threads = QThread::idealThreadCount();
+    if (threads > count)
+        threads = count;
+    if (threads < 1)
+        threads = 1;
+
+    debug::debug("Hashing", count, "blobs using", threads, "threads");
+
+    std::vector<QByteArray> shas(count);
+    std::atomic<int> next(0);
+    std::exception_ptr failure;
+    std::mutex lock;
+
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            try {
+                shas[i] = blob(paths.at(i));
+                // callback is called only in the calling thread
+                if (reporter)
+                    reporter->add(1, QFileInfo(paths.at(i)).size());
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!failure)
+                    failure = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; ++i)
+        pool.push_back(std::thread(worker));
+    worker();
+    for (auto &t: pool)
+        t.join();
+
+    if (failure)
+        std::rethrow_exception(failure);
+
+    for (int i = 0; i < count; ++i)
+        res.insert(paths.at(i), shas[i]);
+    return res;
+}
+
+Stat stat(QString const &path)
+{
+    Stat res;
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) == 0 && S_ISREG(st.st_mode)) {
+        res.size = st.st_size;
+        res.mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    return res;
+}
+
+// entries modified not long before cache was loaded can be changed
+// again w/o visible mtime change, so they are not trusted
+static const qint64 racyInterval = qint64(2) * 1000000000;
+
+Cache::Cache(QString const &fname)
+    : m_fname(fname)
+    , m_started(QDateTime::currentMSecsSinceEpoch() * 1000000)
+{
+}
+
+void Cache::load()
+{
+    m_entries.clear();
+    m_started = QDateTime::currentMSecsSinceEpoch() * 1000000;
+    QFile file(m_fname);
+    if (!file.exists())
+        return;
+    if (!file.open(QIODevice::ReadOnly)) {
+        debug::warning("Can't read hash cache", m_fname);
+        return;
+    }
+    // line format: <sha> <size> <mtime> <path>
+    while (!file.atEnd()) {
+        auto line = file.readLine();
+        line.chop(1);
+        auto s1 = line.indexOf(' ');
+        auto s2 = line.indexOf(' ', s1 + 1);
+        auto s3 = line.indexOf(' ', s2 + 1);
+        if (s1 != 40 || s2 < 0 || s3 < 0) {
+            debug::warning("Broken hash cache, ignoring", m_fname);
+            m_entries.clear();
+            return;
+        }
+        Entry e;
+        e.sha = line.left(s1);
+        e.stat.size = line.mid(s1 + 1, s2 - s1 - 1).toLongLong();
+        e.stat.mtime = line.mid(s2 + 1, s3 - s2 - 1).toLongLong();
+        e.used = false;
+        m_entries.insert(QString::fromUtf8(line.mid(s3 + 1)), e);
+    }
+}
+
+bool Cache::save()
+{
+    QSaveFile file(m_fname);
+    if (!file.open(QIODevice::WriteOnly)) {
+        debug::warning("Can't write hash cache", m_fname);
+        return false;
+    }
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        auto const &e = it.value();
+        auto path = it.key().toUtf8();
+        if (path.contains('\n'))
+            continue;
+        QByteArray line(e.sha);
+        line.append(' ').append(QByteArray::number(e.stat.size))
+            .append(' ').append(QByteArray::number(e.stat.mtime))
+            .append(' ').append(path).append('\n');
+        file.write(line);
+    }
+    return file.commit();
+}
+
+QByteArray Cache::get(QString const &path, Stat const &st) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(path);
+    if (it == m_entries.end() || !st.isValid())
+        return QByteArray();
+    auto const &e = it.value();
+    if (e.stat.size != st.size || e.stat.mtime != st.mtime)
+        return QByteArray();
+    e.used = true;
+    return e.sha;
+}
+
+void Cache::put(QString const &path, Stat const &st, QByteArray const &sha)
+{
+    if (!st.isValid() || sha.size() != 40)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (st.mtime >= m_started - racyInterval) {
+        m_entries.remove(path);
+        return;
+    }
+    Entry e;
+    e.stat = st;
+    e.sha = sha;
+    e.used = true;
+    m_entries.insert(path, e);
+}
+
+void Cache::forgetUnused(QString const &prefix)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (!it.value().used && it.key().startsWith(prefix))
+            it = m_entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+}}
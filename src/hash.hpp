@@ -0,0 +1,83 @@
+#ifndef _VAULT_HASH_HPP_
+#define _VAULT_HASH_HPP_
+/**
+ * @file hash.hpp
+ * @brief Git-compatible blob hashing
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QtGlobal>
+
+#include <mutex>
+
+namespace vault {
+
+namespace progress { class Reporter; }
+
+namespace hash {
+
+/// the same sha1 as "git hash-object <path>" produces, file is read
+/// using bounded buffer
+QByteArray blob(QString const &path);
+/// sha1 of the data in the git blob format
+QByteArray blob(char const *data, qint64 len);
+
+/// hashes all paths on the pool of threads, threads <= 0 means ideal
+/// thread count. Returns path -> sha map, raises on the first error.
+/// Each hashed file is added to the progress
+QHash<QString, QByteArray> blobs(QStringList const &paths, int threads = 0
+                                 , progress::Reporter *reporter = nullptr);
+
+/// stat information used to decide if file is unchanged
+struct Stat
+{
+    Stat() : size(-1), mtime(-1) {}
+    bool isValid() const { return size >= 0; }
+    qint64 size;
+    qint64 mtime; // ns
+};
+
+Stat stat(QString const &path);
+
+/**
+ * Persistent cache: path -> (size, mtime, sha). Path is relative to
+ * the vault root, so the key survives re-export of the unit
+ * (re-exported file gets a new inode but preserves mtime). Lookups
+ * and updates are thread-safe.
+ */
+class Cache
+{
+public:
+    explicit Cache(QString const &fname);
+
+    void load();
+    bool save();
+
+    QByteArray get(QString const &path, Stat const &) const;
+    void put(QString const &path, Stat const &, QByteArray const &sha);
+    /// drop entries below prefix which were not used since load()
+    void forgetUnused(QString const &prefix);
+
+private:
+    struct Entry
+    {
+        Stat stat;
+        QByteArray sha;
+        mutable bool used;
+    };
+
+    QString m_fname;
+    qint64 m_started;
+    QHash<QString, Entry> m_entries;
+    mutable std::mutex m_mutex;
+};
+
+}}
+
+#endif // _VAULT_HASH_HPP_
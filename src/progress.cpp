@@ -0,0 +1,171 @@
+/**
+ * @file progress.cpp
+ * @brief Structured progress events
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <vault/progress.hpp>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <array>
+
+namespace vault { namespace progress {
+
+namespace {
+
+const std::array<char const *, 6> phaseNames = {{
+        "export", "import", "hash", "materialize", "archive", "extract"
+    }};
+
+}
+
+const char linePrefix[] = "progress:";
+
+QString name(Phase phase)
+{
+    return phaseNames.at(static_cast<size_t>(phase));
+}
+
+QVariantMap Event::toMap() const
+{
+    return {{"type", "progress"}, {"phase", name(phase)}, {"unit", unit}
+        , {"filesDone", filesDone}, {"filesTotal", filesTotal}
+        , {"bytesDone", bytesDone}, {"bytesTotal", bytesTotal}
+        , {"rate", rate}, {"eta", eta}};
+}
+
+Event Event::fromMap(QVariantMap const &data)
+{
+    Event res;
+    auto phase = data.value("phase").toString();
+    for (size_t i = 0; i < phaseNames.size(); ++i) {
+        if (phase == phaseNames[i])
+            res.phase = static_cast<Phase>(i);
+    }
+    res.unit = data.value("unit").toString();
+    res.filesDone = data.value("filesDone", res.filesDone).toLongLong();
+    res.filesTotal = data.value("filesTotal", res.filesTotal).toLongLong();
+    res.bytesDone = data.value("bytesDone", res.bytesDone).toLongLong();
+    res.bytesTotal = data.value("bytesTotal", res.bytesTotal).toLongLong();
+    res.rate = data.value("rate", res.rate).toDouble();
+    res.eta = data.value("eta", res.eta).toLongLong();
+    return res;
+}
+
+QByteArray Event::toLine() const
+{
+    auto data = QJsonDocument(QJsonObject::fromVariantMap(toMap()))
+        .toJson(QJsonDocument::Compact);
+    return QByteArray(linePrefix) + " " + data;
+}
+
+bool Event::fromLine(QString const &line, Event &res)
+{
+    if (!line.startsWith(QLatin1String(linePrefix)))
+        return false;
+    auto json = line.mid(int(sizeof(linePrefix)) - 1).trimmed();
+    if (!json.startsWith('{'))
+        return false;
+    auto doc = QJsonDocument::fromJson(json.toUtf8());
+    if (!doc.isObject())
+        return false;
+    auto data = doc.object().toVariantMap();
+    if (data.value("type") != "progress")
+        return false;
+    res = fromMap(data);
+    return true;
+}
+
+Reporter::Reporter(Callback const &callback, Phase phase, QString const &unit
+                   , int interval)
+    : m_callback(callback)
+    , m_phase(phase)
+    , m_unit(unit)
+    , m_interval(interval)
+    , m_owner(std::this_thread::get_id())
+    , m_next(interval)
+    , m_filesDone(0)
+    , m_filesTotal(-1)
+    , m_bytesDone(0)
+    , m_bytesTotal(-1)
+{
+    m_timer.start();
+}
+
+void Reporter::setTotal(qint64 files, qint64 bytes)
+{
+    m_filesTotal = files;
+    m_bytesTotal = bytes;
+}
+
+void Reporter::addTotal(qint64 files, qint64 bytes)
+{
+    // unknown total is replaced
+    auto add = [](std::atomic<qint64> &total, qint64 value) {
+        auto v = total.load();
+        while (!total.compare_exchange_weak(v, std::max(v, qint64(0)) + value)) {}
+    };
+    add(m_filesTotal, files);
+    add(m_bytesTotal, bytes);
+}
+
+void Reporter::add(qint64 files, qint64 bytes)
+{
+    m_filesDone += files;
+    m_bytesDone += bytes;
+    report();
+}
+
+void Reporter::set(qint64 files, qint64 bytes)
+{
+    m_filesDone = files;
+    m_bytesDone = bytes;
+    report();
+}
+
+void Reporter::report()
+{
+    if (!m_callback || std::this_thread::get_id() != m_owner)
+        return;
+    auto now = m_timer.elapsed();
+    if (now < m_next)
+        return;
+    m_next = now + m_interval;
+    m_callback(event());
+}
+
+void Reporter::flush()
+{
+    if (!m_callback)
+        return;
+    m_next = m_timer.elapsed() + m_interval;
+    m_callback(event());
+}
+
+Event Reporter::event() const
+{
+    Event res;
+    res.phase = m_phase;
+    res.unit = m_unit;
+    res.filesDone = m_filesDone;
+    res.filesTotal = m_filesTotal;
+    res.bytesDone = m_bytesDone;
+    res.bytesTotal = m_bytesTotal;
+    auto elapsed = m_timer.elapsed();
+    if (elapsed > 0)
+        res.rate = res.bytesDone * 1000.0 / elapsed;
+    if (res.bytesTotal >= 0 && res.rate > 0) {
+        res.eta = qint64(std::max(res.bytesTotal - res.bytesDone, qint64(0)) / res.rate);
+    } else if (res.filesTotal >= 0 && res.filesDone > 0) {
+        res.eta = elapsed * std::max(res.filesTotal - res.filesDone, qint64(0))
+            / res.filesDone / 1000;
+    }
+    return res;
+}
+
+}}
@@ -0,0 +1,276 @@
+/**
+ * @file repo.cpp
+ * @brief Git index/worktree backends used to stage units data
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "repo.hpp"
+#include "git.hpp"
+
+#include <qtaround/error.hpp>
+
+#include <gittin/repo.hpp>
+#include <gittin/repostatus.hpp>
+
+#include <QDir>
+#include <QFile>
+
+#ifdef VAULT_HAVE_LIBGIT2
+#include <git2.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+namespace error = qtaround::error;
+
+namespace vault { namespace repo {
+
+bool isDirty(QList<Change> const &changes)
+{
+    for (auto const &c : changes) {
+        if (c.workTree != ' ')
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+// git executable is started for each operation
+class Cli : public Backend
+{
+public:
+    Cli(QString const &path) : m_vcs(path) {}
+
+    QString name() const { return "cli"; }
+
+    QList<Change> status(QString const &path)
+    {
+        QList<Change> res;
+        Gittin::RepoStatus status = m_vcs.status(path);
+        for (auto const &file : status.files())
+            res.push_back({file.file, QChar(file.index).toLatin1()
+                        , QChar(file.workTree).toLatin1()});
+        return res;
+    }
+
+    void update(QStringList const &paths)
+    {
+        git::IndexBatch index(m_vcs.path());
+        for (auto const &path : paths)
+            index.add(path);
+        index.flush();
+    }
+
+    void addAll(QString const &path)
+    {
+        m_vcs.add(path, Gittin::AddOptions::All);
+    }
+
+private:
+    Gittin::Repo m_vcs;
+};
+
+#ifdef VAULT_HAVE_LIBGIT2
+
+// repository and index are kept open, index is re-read only if it
+// was changed on disk (e.g. by gittin)
+class LibGit2 : public Backend
+{
+public:
+    LibGit2(QString const &path)
+        : m_root(QDir(path).absolutePath())
+        , m_repo(nullptr)
+        , m_index(nullptr)
+    {
+        git_libgit2_init();
+        auto rc = git_repository_open(&m_repo, QFile::encodeName(m_root).constData());
+        if (rc >= 0)
+            rc = git_repository_index(&m_index, m_repo);
+        if (rc < 0) {
+            auto msg = lastError();
+            release();
+            error::raise({{"msg", "Can't open repository"}, {"path", path}
+                    , {"error", msg}});
+        }
+    }
+
+    ~LibGit2()
+    {
+        release();
+    }
+
+    QString name() const { return "libgit2"; }
+
+    QList<Change> status(QString const &path)
+    {
+        QList<Change> res;
+        auto spec = QFile::encodeName(relative(path));
+        char *specs[] = {spec.data()};
+
+        git_status_options opts;
+        check(git_status_options_init(&opts, GIT_STATUS_OPTIONS_VERSION), "status");
+        opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+        opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED
+            | GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+        opts.pathspec.strings = specs;
+        opts.pathspec.count = spec.isEmpty() ? 0 : 1;
+
+        git_status_list *list = nullptr;
+        check(git_status_list_new(&list, m_repo, &opts), "status");
+        auto count = git_status_list_entrycount(list);
+        for (size_t i = 0; i < count; ++i) {
+            auto entry = git_status_byindex(list, i);
+            auto delta = entry->head_to_index ? entry->head_to_index
+                : entry->index_to_workdir;
+            if (!delta)
+                continue;
+            auto fname = delta->new_file.path ? delta->new_file.path
+                : delta->old_file.path;
+            Change change = {QFile::decodeName(fname)
+                             , indexCode(entry->status)
+                             , workTreeCode(entry->status)};
+            if (change.workTree == '?')
+                change.index = '?';
+            res.push_back(change);
+        }
+        git_status_list_free(list);
+        return res;
+    }
+
+    void update(QStringList const &paths)
+    {
+        check(git_index_read(m_index, 0), "read index");
+        for (auto const &path : paths) {
+            auto fname = QFile::encodeName(path);
+            auto full = QFile::encodeName(QDir(m_root).filePath(path));
+            struct stat st;
+            auto rc = ::lstat(full.constData(), &st)
+                ? git_index_remove_bypath(m_index, fname.constData())
+                : git_index_add_bypath(m_index, fname.constData());
+            check(rc, "update index");
+        }
+        check(git_index_write(m_index), "write index");
+    }
+
+    void addAll(QString const &path)
+    {
+        auto spec = QFile::encodeName(relative(path));
+        char *specs[] = {spec.data()};
+        git_strarray pathspec;
+        pathspec.strings = specs;
+        pathspec.count = spec.isEmpty() ? 0 : 1;
+
+        check(git_index_read(m_index, 0), "read index");
+        check(git_index_add_all(m_index, &pathspec, GIT_INDEX_ADD_DEFAULT
+                                , nullptr, nullptr), "add");
+        // add_all does not stage removals
+        check(git_index_update_all(m_index, &pathspec, nullptr, nullptr), "add");
+        check(git_index_write(m_index), "write index");
+    }
+
+private:
+
+    static QString lastError()
+    {
+        auto err = git_error_last();
+        return err ? QString::fromUtf8(err->message) : QString();
+    }
+
+    static void check(int rc, char const *op)
+    {
+        if (rc < 0)
+            error::raise({{"msg", "libgit2 failed"}, {"op", op}
+                    , {"rc", rc}, {"error", lastError()}});
+    }
+
+    static char indexCode(unsigned status)
+    {
+        if (status & GIT_STATUS_INDEX_NEW)
+            return 'A';
+        if (status & GIT_STATUS_INDEX_MODIFIED)
+            return 'M';
+        if (status & GIT_STATUS_INDEX_DELETED)
+            return 'D';
+        if (status & GIT_STATUS_INDEX_RENAMED)
+            return 'R';
+        if (status & GIT_STATUS_INDEX_TYPECHANGE)
+            return 'T';
+        return ' ';
+    }
+
+    static char workTreeCode(unsigned status)
+    {
+        if (status & GIT_STATUS_WT_NEW)
+            return '?';
+        if (status & GIT_STATUS_WT_MODIFIED)
+            return 'M';
+        if (status & GIT_STATUS_WT_DELETED)
+            return 'D';
+        if (status & GIT_STATUS_WT_RENAMED)
+            return 'R';
+        if (status & GIT_STATUS_WT_TYPECHANGE)
+            return 'T';
+        if (status & GIT_STATUS_CONFLICTED)
+            return 'U';
+        return ' ';
+    }
+
+    QString relative(QString const &path) const
+    {
+        auto res = QDir(m_root).relativeFilePath(path);
+        return res == "." ? QString() : res;
+    }
+
+    void release()
+    {
+        if (m_index)
+            git_index_free(m_index);
+        if (m_repo)
+            git_repository_free(m_repo);
+        m_index = nullptr;
+        m_repo = nullptr;
+        git_libgit2_shutdown();
+    }
+
+    QString m_root;
+    git_repository *m_repo;
+    git_index *m_index;
+};
+
+#endif // VAULT_HAVE_LIBGIT2
+
+}
+
+bool isAvailable(Kind kind)
+{
+#ifdef VAULT_HAVE_LIBGIT2
+    (void)kind;
+    return true;
+#else
+    return kind != Kind::LibGit2;
+#endif
+}
+
+std::unique_ptr<Backend> create(QString const &path, Kind kind)
+{
+    if (kind == Kind::Default) {
+#ifdef VAULT_HAVE_LIBGIT2
+        kind = Kind::LibGit2;
+#else
+        kind = Kind::Cli;
+#endif
+    }
+    if (kind == Kind::Cli)
+        return std::unique_ptr<Backend>(new Cli(path));
+#ifdef VAULT_HAVE_LIBGIT2
+    return std::unique_ptr<Backend>(new LibGit2(path));
+#else
+    error::raise({{"msg", "Vault is built w/o libgit2 support"}});
+    return std::unique_ptr<Backend>();
+#endif
+}
+
+}}
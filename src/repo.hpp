@@ -0,0 +1,65 @@
+#ifndef _VAULT_REPO_HPP_
+#define _VAULT_REPO_HPP_
+/**
+ * @file repo.hpp
+ * @brief Git index/worktree backends used to stage units data
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include <memory>
+
+namespace vault { namespace repo {
+
+/// status entry in "git status --porcelain" terms, path is relative
+/// to the repo root
+struct Change
+{
+    QString path;
+    char index;
+    char workTree;
+};
+
+/// there are unstaged changes or untracked files
+bool isDirty(QList<Change> const &changes);
+
+/**
+ * Operations issued per unit during backup. Snapshot-level
+ * operations (commit, tag, checkout) are done through gittin.
+ */
+class Backend
+{
+public:
+    virtual ~Backend() {}
+
+    virtual QString name() const = 0;
+
+    /// changes including untracked files under path (absolute or
+    /// relative to the repo root)
+    virtual QList<Change> status(QString const &path) = 0;
+    /// add paths (relative to the repo root) to the index or remove
+    /// them if they are absent in the worktree
+    virtual void update(QStringList const &paths) = 0;
+    /// stage all changes under path, including removals
+    virtual void addAll(QString const &path) = 0;
+};
+
+enum class Kind {
+    Default, // selected by VAULT_GIT_BACKEND at build time
+    Cli,
+    LibGit2
+};
+
+bool isAvailable(Kind kind);
+
+/// raises if backend is not built in
+std::unique_ptr<Backend> create(QString const &path, Kind kind = Kind::Default);
+
+}}
+
+#endif // _VAULT_REPO_HPP_
@@ -0,0 +1,111 @@
+/**
+ * @file retention.cpp
+ * @brief Snapshots retention policy
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "retention.hpp"
+#include "git.hpp"
+
+#include <qtaround/error.hpp>
+
+#include <QSet>
+
+#include <algorithm>
+
+namespace error = qtaround::error;
+
+namespace vault { namespace retention {
+
+namespace {
+
+const qint64 secondsPerDay = 24 * 60 * 60;
+
+qint64 toSize(QVariant const &v, QString const &name)
+{
+    if (!v.isValid())
+        return 0;
+    bool ok = false;
+    auto res = git::parseSize(v.toString(), &ok);
+    if (!ok || res < 0)
+        error::raise({{"msg", "Invalid retention policy value"}
+                , {"name", name}, {"value", v}});
+    return res;
+}
+
+}
+
+Policy Policy::fromMap(QVariantMap const &data)
+{
+    Policy res;
+    res.last = toSize(data.value("last"), "last");
+    res.daily = toSize(data.value("daily"), "daily");
+    res.weekly = toSize(data.value("weekly"), "weekly");
+    res.maxSize = toSize(data.value("max-size"), "max-size");
+    return res;
+}
+
+Policy Policy::fromConfig(QString const &repo)
+{
+    Policy res;
+    res.last = git::config(repo, "vault.keepLast", qint64(0));
+    res.daily = git::config(repo, "vault.keepDaily", qint64(0));
+    res.weekly = git::config(repo, "vault.keepWeekly", qint64(0));
+    res.maxSize = git::config(repo, "vault.keepMaxSize", qint64(0));
+    return res;
+}
+
+QStringList select(QList<catalog::Entry> entries, Policy const &policy
+                   , qint64 now, SizeFn const &size)
+{
+    QStringList res;
+    if (entries.isEmpty() || policy.isEmpty())
+        return res;
+
+    // newest first
+    std::sort(entries.begin(), entries.end()
+              , [](catalog::Entry const &a, catalog::Entry const &b) {
+                  return a.timestamp != b.timestamp
+                      ? a.timestamp > b.timestamp : a.tag > b.tag;
+              });
+
+    QSet<QString> keep;
+    keep.insert(entries.first().tag);
+    auto hasRules = policy.last || policy.daily || policy.weekly;
+    auto today = now / secondsPerDay;
+    // epoch day 0 is Thursday
+    auto thisWeek = (today + 3) / 7;
+    QSet<qint64> days, weeks;
+    for (int i = 0; i < entries.size(); ++i) {
+        auto const &entry = entries[i];
+        auto day = entry.timestamp / secondsPerDay;
+        auto week = (day + 3) / 7;
+        if (!hasRules || i < policy.last)
+            keep.insert(entry.tag);
+        if (day > today - policy.daily && !days.contains(day)) {
+            days.insert(day);
+            keep.insert(entry.tag);
+        }
+        if (week > thisWeek - policy.weekly && !weeks.contains(week)) {
+            weeks.insert(week);
+            keep.insert(entry.tag);
+        }
+    }
+
+    QList<catalog::Entry> kept;
+    for (auto const &entry : entries) {
+        if (keep.contains(entry.tag))
+            kept.push_back(entry);
+        else
+            res.push_back(entry.tag);
+    }
+    if (policy.maxSize && size) {
+        while (kept.size() > 1 && size(kept) > policy.maxSize)
+            res.push_back(kept.takeLast().tag);
+    }
+    return res;
+}
+
+}}
@@ -0,0 +1,57 @@
+#ifndef _VAULT_RETENTION_HPP_
+#define _VAULT_RETENTION_HPP_
+/**
+ * @file retention.hpp
+ * @brief Snapshots retention policy
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "catalog.hpp"
+
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+#include <QList>
+
+#include <functional>
+
+namespace vault { namespace retention {
+
+struct Policy
+{
+    Policy() : last(0), daily(0), weekly(0), maxSize(0) {}
+
+    int last; // keep last N snapshots
+    int daily; // keep the newest snapshot of each of the last N days
+    int weekly; // the same for weeks (starting on Monday)
+    qint64 maxSize; // drop oldest snapshots while storage is bigger
+
+    /// nothing is removed by the empty policy
+    inline bool isEmpty() const { return !last && !daily && !weekly && !maxSize; }
+
+    /// "last", "daily", "weekly", "max-size" keys (git-style size
+    /// suffixes are accepted)
+    static Policy fromMap(QVariantMap const &);
+    /// vault.keepLast, vault.keepDaily, vault.keepWeekly,
+    /// vault.keepMaxSize options
+    static Policy fromConfig(QString const &repo);
+};
+
+/// storage bytes used by snapshots
+typedef std::function<qint64 (QList<catalog::Entry> const &)> SizeFn;
+
+/**
+ * Tags of snapshots to be removed. Snapshots matching any of
+ * last/daily/weekly rules are kept (all are kept if no rule is set),
+ * then the oldest ones are dropped until size of the rest fits
+ * maxSize. The newest snapshot is always kept. now is in seconds
+ * since epoch, days are counted in UTC.
+ */
+QStringList select(QList<catalog::Entry> entries, Policy const &policy
+                   , qint64 now, SizeFn const &size = nullptr);
+
+}}
+
+#endif // _VAULT_RETENTION_HPP_
@@ -0,0 +1,246 @@
+/**
+ * @file scheduler.cpp
+ * @brief Concurrent execution of units scripts
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "scheduler.hpp"
+
+#include <qtaround/debug.hpp>
+#include <qtaround/error.hpp>
+
+#include <QFile>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QSet>
+
+#include <algorithm>
+#include <thread>
+#include <map>
+
+namespace debug = qtaround::debug;
+namespace error = qtaround::error;
+
+namespace vault { namespace scheduler {
+
+Scheduler::Scheduler(int limit)
+    : m_limit(limit > 0 ? limit : 1)
+{
+}
+
+void Scheduler::add(QString const &name, Job const &job, qint64 expected)
+{
+    m_tasks.push_back({name, job, expected});
+}
+
+void Scheduler::addDependency(QString const &name, QString const &dependency)
+{
+    if (name != dependency && !m_dependencies[name].contains(dependency))
+        m_dependencies[name].push_back(dependency);
+}
+
+namespace {
+
+std::exception_ptr cancelled(QString const &name, QString const &msg, QString const &cause)
+{
+    try {
+        error::raise({{"msg", msg}, {"reason", "cancelled"}, {"name", name}
+                , {"cause", cause}});
+    } catch (...) {
+        return std::current_exception();
+    }
+    return std::exception_ptr();
+}
+
+}
+
+void Scheduler::run(StartHandler const &onStart, DoneHandler const &onDone)
+{
+    auto tasks = m_tasks;
+    auto dependencies = m_dependencies;
+    m_tasks.clear();
+    m_dependencies.clear();
+    std::stable_sort(tasks.begin(), tasks.end(), [](Task const &a, Task const &b) {
+            return a.expected > b.expected;
+        });
+
+    // dependency graph: jobs each job is waiting for and jobs waiting
+    // for it
+    QMap<QString, int> indices;
+    for (int i = 0; i < tasks.size(); ++i)
+        indices[tasks[i].name] = i;
+    QList<QSet<int> > waiting;
+    QList<QList<int> > dependents;
+    for (int i = 0; i < tasks.size(); ++i) {
+        waiting.push_back(QSet<int>());
+        dependents.push_back(QList<int>());
+    }
+    for (int i = 0; i < tasks.size(); ++i) {
+        for (auto const &name : dependencies.value(tasks[i].name)) {
+            auto found = indices.find(name);
+            if (found == indices.end())
+                continue;
+            waiting[i].insert(found.value());
+            dependents[found.value()].push_back(i);
+        }
+    }
+
+    struct Done
+    {
+        int index;
+        qint64 elapsed;
+        std::exception_ptr error;
+    };
+
+    auto &mutex = m_mutex;
+    auto &cond = m_cond;
+    QList<Done> done;
+    std::map<int, std::thread> running;
+    // not started yet, in the start order
+    QList<int> pending;
+    for (int i = 0; i < tasks.size(); ++i)
+        pending.push_back(i);
+
+    std::function<void (int, bool)> finish = [&](int i, bool isOk) {
+        for (auto d : dependents[i]) {
+            if (!pending.contains(d))
+                continue;
+            if (isOk) {
+                waiting[d].remove(i);
+                continue;
+            }
+            pending.removeOne(d);
+            onDone(tasks[d].name, 0, cancelled
+                   (tasks[d].name, "Dependency is failed", tasks[i].name));
+            finish(d, false);
+        }
+    };
+
+    auto start = [&](int i) {
+        auto const &task = tasks[i];
+        try {
+            onStart(task.name);
+        } catch (...) {
+            onDone(task.name, 0, std::current_exception());
+            finish(i, false);
+            return;
+        }
+        auto job = task.job;
+        running[i] = std::thread([i, job, &mutex, &cond, &done]() {
+                QElapsedTimer timer;
+                timer.start();
+                std::exception_ptr error;
+                try {
+                    job();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back({i, timer.elapsed(), error});
+                cond.notify_one();
+            });
+    };
+
+    try {
+        while (!pending.isEmpty() || !running.empty()) {
+            QList<int> ready;
+            for (auto i : pending) {
+                if (waiting[i].isEmpty()
+                    && int(running.size() + ready.size()) < m_limit)
+                    ready.push_back(i);
+            }
+            for (auto i : ready) {
+                // can be cancelled by the failed start of other job
+                if (pending.removeOne(i))
+                    start(i);
+            }
+            if (running.empty()) {
+                if (ready.isEmpty()) {
+                    // the rest is waiting for each other
+                    for (auto i : pending)
+                        onDone(tasks[i].name, 0, cancelled
+                               (tasks[i].name, "Dependency cycle", tasks[i].name));
+                    pending.clear();
+                }
+                continue;
+            }
+
+            Done item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this, &done]() {
+                        return !done.isEmpty() || !m_posted.isEmpty();
+                    });
+                if (done.isEmpty()) {
+                    lock.unlock();
+                    runPosted();
+                    continue;
+                }
+                item = done.takeFirst();
+            }
+            // everything posted by the job is handled before its
+            // completion
+            runPosted();
+            running[item.index].join();
+            running.erase(item.index);
+            onDone(tasks[item.index].name, item.elapsed, item.error);
+            finish(item.index, !item.error);
+        }
+    } catch (...) {
+        debug::error("Scheduler is interrupted, waiting for running jobs");
+        for (auto &t : running)
+            t.second.join();
+        throw;
+    }
+}
+
+void Scheduler::post(std::function<void ()> const &fn)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_posted.push_back(fn);
+    m_cond.notify_one();
+}
+
+void Scheduler::runPosted()
+{
+    QList<std::function<void ()> > posted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        posted.swap(m_posted);
+    }
+    for (auto const &fn : posted)
+        fn();
+}
+
+Durations::Durations(QString const &fname)
+    : m_fname(fname)
+{
+}
+
+void Durations::load()
+{
+    QFile file(m_fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    while (!file.atEnd()) {
+        auto line = file.readLine().trimmed();
+        auto sep = line.indexOf(' ');
+        if (sep <= 0)
+            continue;
+        m_data[QString::fromUtf8(line.mid(sep + 1))] = line.left(sep).toLongLong();
+    }
+}
+
+bool Durations::save() const
+{
+    QSaveFile file(m_fname);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    for (auto it = m_data.begin(); it != m_data.end(); ++it)
+        file.write(QByteArray::number(it.value()) + ' ' + it.key().toUtf8() + '\n');
+    return file.commit();
+}
+
+}}
@@ -0,0 +1,90 @@
+#ifndef _VAULT_SCHEDULER_HPP_
+#define _VAULT_SCHEDULER_HPP_
+/**
+ * @file scheduler.hpp
+ * @brief Concurrent execution of units scripts
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QList>
+#include <QMap>
+#include <QStringList>
+
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+
+namespace vault { namespace scheduler {
+
+/**
+ * Runs jobs in worker threads, not more than limit at once. Jobs with
+ * longer expected duration are started first among jobs which
+ * dependencies are done. Start and completion handlers are called in
+ * the thread calling run(), so everything not thread-safe (git, blob
+ * storage, progress callbacks) is done there serialized.
+ */
+class Scheduler
+{
+public:
+    typedef std::function<void ()> Job;
+    /// called before job is started, job is not started if it throws
+    typedef std::function<void (QString const &)> StartHandler;
+    /// error is set if job (or start handler) has thrown
+    typedef std::function<void (QString const &, qint64 elapsed
+                                , std::exception_ptr error)> DoneHandler;
+
+    explicit Scheduler(int limit);
+
+    void add(QString const &name, Job const &job, qint64 expected = 0);
+    /// job is started only after the dependency is successfully
+    /// done. If dependency fails, job is not started and reported as
+    /// failed with "cancelled" reason, the same is done for jobs in
+    /// the dependency cycle. Dependencies on absent jobs are ignored
+    void addDependency(QString const &name, QString const &dependency);
+    void run(StartHandler const &, DoneHandler const &);
+    /// run fn in the thread calling run(), can be called by jobs to
+    /// report progress
+    void post(std::function<void ()> const &fn);
+
+private:
+    void runPosted();
+
+    struct Task
+    {
+        QString name;
+        Job job;
+        qint64 expected;
+    };
+
+    int m_limit;
+    QList<Task> m_tasks;
+    QMap<QString, QStringList> m_dependencies;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    QList<std::function<void ()> > m_posted;
+};
+
+/// durations (ms) of previous runs, stored as "<ms> <name>" lines
+class Durations
+{
+public:
+    explicit Durations(QString const &fname);
+
+    void load();
+    bool save() const;
+
+    inline qint64 get(QString const &name) const { return m_data.value(name, 0); }
+    inline void set(QString const &name, qint64 ms) { m_data[name] = ms; }
+
+private:
+    QString m_fname;
+    QMap<QString, qint64> m_data;
+};
+
+}}
+
+#endif // _VAULT_SCHEDULER_HPP_
@@ -0,0 +1,215 @@
+/**
+ * @file script.cpp
+ * @brief Execution of units scripts with bounded output capture
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "script.hpp"
+#include "git.hpp"
+#include <vault/progress.hpp>
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QProcess>
+#include <QFile>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/resource.h>
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace script {
+
+RingBuffer::RingBuffer(qint64 capacity)
+    : m_capacity(std::max(capacity, qint64(0)))
+    , m_start(0)
+    , m_size(0)
+    , m_total(0)
+{
+}
+
+void RingBuffer::append(QByteArray const &data)
+{
+    m_total += data.size();
+    if (!m_capacity || data.isEmpty())
+        return;
+    if (m_data.isEmpty())
+        m_data.resize(m_capacity);
+
+    auto src = data.constData();
+    qint64 len = data.size();
+    if (len >= m_capacity) {
+        std::memcpy(m_data.data(), src + len - m_capacity, m_capacity);
+        m_start = 0;
+        m_size = m_capacity;
+        return;
+    }
+    auto end = (m_start + m_size) % m_capacity;
+    auto first = std::min(len, m_capacity - end);
+    std::memcpy(m_data.data() + end, src, first);
+    std::memcpy(m_data.data(), src + first, len - first);
+    m_size += len;
+    if (m_size > m_capacity) {
+        m_start = (m_start + m_size - m_capacity) % m_capacity;
+        m_size = m_capacity;
+    }
+}
+
+QByteArray RingBuffer::data() const
+{
+    QByteArray res;
+    auto first = std::min(m_size, m_capacity - m_start);
+    res.append(m_data.constData() + m_start, first);
+    res.append(m_data.constData(), m_size - first);
+    return res;
+}
+
+Options Options::fromConfig(QString const &repo)
+{
+    Options res;
+    res.timeout = git::config(repo, "vault.scriptTimeout", qint64(0)) * 1000;
+    res.outputLimit = git::config(repo, "vault.scriptOutputLimit", res.outputLimit);
+    res.cpuLimit = git::config(repo, "vault.scriptCpuLimit", qint64(0));
+    res.fileSizeLimit = git::config(repo, "vault.scriptFileSizeLimit", qint64(0));
+    if (git::config(repo, "vault.scriptLog") == "true")
+        res.logDir = os::path::join(repo, ".git", "vault.logs");
+    return res;
+}
+
+namespace {
+
+// limits are applied in the child process before exec
+class Process : public QProcess
+{
+public:
+    Process(Options const &options)
+        : m_cpuLimit(options.cpuLimit)
+        , m_fileSizeLimit(options.fileSizeLimit)
+    {}
+
+protected:
+    void setupChildProcess()
+    {
+        if (m_cpuLimit > 0) {
+            struct rlimit limit = { rlim_t(m_cpuLimit), rlim_t(m_cpuLimit) };
+            ::setrlimit(RLIMIT_CPU, &limit);
+        }
+        if (m_fileSizeLimit > 0) {
+            struct rlimit limit = { rlim_t(m_fileSizeLimit), rlim_t(m_fileSizeLimit) };
+            ::setrlimit(RLIMIT_FSIZE, &limit);
+        }
+    }
+
+private:
+    qint64 m_cpuLimit;
+    qint64 m_fileSizeLimit;
+};
+
+// script gets this time to exit after SIGTERM
+const int terminateTimeout = 3000;
+// output is drained at least this often
+const int pollInterval = 100;
+
+}
+
+Result run(QString const &name, QString const &program, QStringList const &args
+           , Options const &options)
+{
+    Result res;
+    QFile log;
+    if (!options.logDir.isEmpty()) {
+        if (!os::path::isDir(options.logDir))
+            os::mkdir(options.logDir, {{"parent", true}});
+        log.setFileName(os::path::join(options.logDir, name + ".log"));
+        if (!log.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            debug::warning("Can't open script log", log.fileName());
+    }
+
+    Process ps(options);
+    if (!options.workingDirectory.isEmpty())
+        ps.setWorkingDirectory(options.workingDirectory);
+    ps.start(program, args);
+    if (!ps.waitForStarted(-1))
+        error::raise({{"msg", "Can't start script"}, {"script", program}
+                , {"error", ps.errorString()}});
+
+    RingBuffer out(options.outputLimit), err(options.outputLimit);
+    // incomplete stdout line, it is not longer than outputLimit
+    QByteArray line;
+    auto drain = [&]() {
+        auto data = ps.readAllStandardOutput();
+        if (!data.isEmpty()) {
+            out.append(data);
+            if (log.isOpen())
+                log.write(data);
+            line.append(data);
+            int pos = 0;
+            for (auto eol = line.indexOf('\n'); eol >= 0; eol = line.indexOf('\n', pos)) {
+                auto text = line.mid(pos, eol - pos);
+                if (options.onProgress && text.startsWith(progress::linePrefix))
+                    options.onProgress(QString::fromUtf8(text.trimmed()));
+                pos = eol + 1;
+            }
+            line.remove(0, pos);
+            if (line.size() > options.outputLimit)
+                line.clear();
+        }
+        data = ps.readAllStandardError();
+        if (!data.isEmpty()) {
+            err.append(data);
+            if (log.isOpen())
+                log.write(data);
+        }
+    };
+
+    auto stop = [&ps, &program](char const *why) {
+        debug::warning("Script is", why, ", terminating", program);
+        ps.terminate();
+        if (!ps.waitForFinished(terminateTimeout)) {
+            ps.kill();
+            ps.waitForFinished(-1);
+        }
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    while (ps.state() != QProcess::NotRunning) {
+        auto wait = pollInterval;
+        if (options.cancel.isCancelled()) {
+            res.isCancelled = true;
+            stop("cancelled");
+            break;
+        }
+        if (options.timeout > 0) {
+            auto left = options.timeout - timer.elapsed();
+            if (left <= 0) {
+                res.isTimedOut = true;
+                stop("timed out");
+                break;
+            }
+            wait = std::min(qint64(wait), left);
+        }
+        ps.waitForReadyRead(wait);
+        drain();
+    }
+    drain();
+
+    res.rc = (ps.exitStatus() == QProcess::NormalExit) ? ps.exitCode() : -1;
+    res.out = out.data();
+    res.err = err.data();
+    if (out.dropped() || err.dropped())
+        debug::debug("Script output is truncated, dropped stdout/stderr bytes"
+                     , out.dropped(), err.dropped());
+    return res;
+}
+
+}}
@@ -0,0 +1,88 @@
+#ifndef _VAULT_SCRIPT_HPP_
+#define _VAULT_SCRIPT_HPP_
+/**
+ * @file script.hpp
+ * @brief Execution of units scripts with bounded output capture
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <vault/cancel.hpp>
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include <functional>
+
+namespace vault { namespace script {
+
+/// keeps only the last capacity bytes of appended data
+class RingBuffer
+{
+public:
+    explicit RingBuffer(qint64 capacity);
+
+    void append(QByteArray const &data);
+    /// kept data in the original order
+    QByteArray data() const;
+    /// count of appended bytes not kept in the buffer
+    inline qint64 dropped() const { return m_total - m_size; }
+
+private:
+    qint64 m_capacity;
+    QByteArray m_data;
+    qint64 m_start;
+    qint64 m_size;
+    qint64 m_total;
+};
+
+struct Options
+{
+    Options()
+        : timeout(0), outputLimit(64 * 1024), cpuLimit(0), fileSizeLimit(0)
+    {}
+
+    int timeout; // ms, script is terminated after it, 0 - no limit
+    qint64 outputLimit; // bytes of stdout and stderr tails kept in memory
+    qint64 cpuLimit; // RLIMIT_CPU (s), 0 - no limit
+    qint64 fileSizeLimit; // RLIMIT_FSIZE (bytes), 0 - no limit
+    QString logDir; // full output is written to <logDir>/<name>.log
+    QString workingDirectory; // current one if empty
+    /// called with progress lines (as is) while script is running
+    std::function<void (QString const &)> onProgress;
+    /// script is terminated if it is cancelled
+    Cancel cancel;
+
+    /// vault.scriptTimeout (s), vault.scriptOutputLimit,
+    /// vault.scriptCpuLimit (s), vault.scriptFileSizeLimit options,
+    /// logs are written to .git/vault.logs if vault.scriptLog is
+    /// "true"
+    static Options fromConfig(QString const &repo);
+};
+
+struct Result
+{
+    Result() : rc(-1), isTimedOut(false), isCancelled(false) {}
+
+    int rc;
+    bool isTimedOut;
+    bool isCancelled;
+    // the last outputLimit bytes of stdout and stderr
+    QByteArray out;
+    QByteArray err;
+};
+
+/**
+ * Run the script and wait for its completion. Output is read while
+ * script is running, so memory usage is bounded by outputLimit
+ * regardless of the output size. Raises only if script can't be
+ * started.
+ */
+Result run(QString const &name, QString const &program, QStringList const &args
+           , Options const &options);
+
+}}
+
+#endif // _VAULT_SCRIPT_HPP_
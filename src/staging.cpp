@@ -0,0 +1,158 @@
+/**
+ * @file staging.cpp
+ * @brief Differential update of the unit tree from the scratch area
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "staging.hpp"
+#include "hash.hpp"
+#include "blobs.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/error.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+
+namespace os = qtaround::os;
+namespace error = qtaround::error;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace staging {
+
+namespace {
+
+const QDir::Filters allEntries = QDir::AllEntries | QDir::Hidden
+    | QDir::System | QDir::NoDotAndDotDot;
+
+void move(QString const &src, QString const &dst)
+{
+    if (::rename(QFile::encodeName(src).constData(), QFile::encodeName(dst).constData()))
+        error::raise({{"msg", "Can't move staged entry"}, {"src", src}, {"dst", dst}});
+}
+
+void remove(QFileInfo const &info)
+{
+    if (info.isDir() && !info.isSymLink())
+        os::rmtree(info.absoluteFilePath());
+    else
+        QFile::remove(info.absoluteFilePath());
+}
+
+// raw target, QFileInfo resolves relative targets
+QByteArray linkTarget(QString const &path)
+{
+    QByteArray res(PATH_MAX, '\0');
+    auto len = ::readlink(QFile::encodeName(path).constData(), res.data(), res.size());
+    res.truncate(len > 0 ? len : 0);
+    return res;
+}
+
+QByteArray blobSha(QString const &path, QString const &relPath, hash::Cache *cache)
+{
+    auto st = hash::stat(path);
+    auto sha = cache ? cache->get(relPath, st) : QByteArray();
+    if (sha.isEmpty()) {
+        sha = hash::blob(path);
+        if (cache)
+            cache->put(relPath, st, sha);
+    }
+    return sha;
+}
+
+bool isSameFile(QFileInfo const &src, QFileInfo const &dst)
+{
+    if (src.size() != dst.size())
+        return false;
+    auto srcStat = hash::stat(src.filePath()), dstStat = hash::stat(dst.filePath());
+    if (srcStat.mtime == dstStat.mtime)
+        return true;
+    // exported again: the same data, but new mtime
+    return hash::blob(src.filePath()) == hash::blob(dst.filePath());
+}
+
+bool isSame(QFileInfo const &src, QFileInfo const &dst, QString const &relPath
+            , bool isBlobs, hash::Cache *cache)
+{
+    if (src.isSymLink())
+        return dst.isSymLink() && linkTarget(src.filePath()) == linkTarget(dst.filePath());
+    if (!src.isFile())
+        return false;
+    if (dst.isSymLink()) {
+        if (!isBlobs)
+            return false;
+        auto sha = blobs::Storage::shaOf(dst.symLinkTarget());
+        return !sha.isEmpty() && sha == blobSha(src.filePath(), relPath, cache);
+    }
+    return dst.isFile() && isSameFile(src, dst);
+}
+
+void syncDir(QString const &src, QString const &dst, QString const &relPath
+             , bool isBlobs, hash::Cache *cache, Stats &stats)
+{
+    QSet<QString> names;
+    for (auto const &info : QDir(src).entryInfoList(allEntries)) {
+        auto name = info.fileName();
+        names.insert(name);
+        auto dstPath = os::path::join(dst, name);
+        auto rel = os::path::join(relPath, name);
+        QFileInfo dstInfo(dstPath);
+        auto dstExists = dstInfo.exists() || dstInfo.isSymLink();
+
+        if (info.isDir() && !info.isSymLink()) {
+            if (dstExists && dstInfo.isDir() && !dstInfo.isSymLink()) {
+                syncDir(info.filePath(), dstPath, rel, isBlobs, cache, stats);
+                continue;
+            }
+            if (dstExists) {
+                remove(dstInfo);
+                ++stats.removed;
+            }
+            // whole new subtree is moved at once
+            move(info.filePath(), dstPath);
+            ++stats.updated;
+            continue;
+        }
+
+        if (dstExists && isSame(info, dstInfo, rel, isBlobs, cache)) {
+            ++stats.kept;
+            continue;
+        }
+        if (dstExists)
+            remove(dstInfo);
+        move(info.filePath(), dstPath);
+        ++stats.updated;
+    }
+
+    for (auto const &info : QDir(dst).entryInfoList(allEntries)) {
+        if (names.contains(info.fileName()))
+            continue;
+        remove(info);
+        ++stats.removed;
+    }
+}
+
+}
+
+Stats sync(QString const &src, QString const &dst, QString const &relPath
+           , bool isBlobs, hash::Cache *cache)
+{
+    Stats stats;
+    if (!os::path::isDir(dst) && !os::mkdir(dst, {{"parent", true}}))
+        error::raise({{"msg", "Can't create dir"}, {"path", dst}});
+    syncDir(src, dst, relPath, isBlobs, cache, stats);
+    debug::debug("Synced", dst, "kept", stats.kept, "updated", stats.updated
+                 , "removed", stats.removed);
+    return stats;
+}
+
+}}
@@ -0,0 +1,41 @@
+#ifndef _VAULT_STAGING_HPP_
+#define _VAULT_STAGING_HPP_
+/**
+ * @file staging.hpp
+ * @brief Differential update of the unit tree from the scratch area
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+
+namespace vault {
+
+namespace hash { class Cache; }
+
+namespace staging {
+
+struct Stats
+{
+    Stats() : kept(0), updated(0), removed(0) {}
+    int kept;
+    int updated;
+    int removed;
+};
+
+/**
+ * Make dst tree the same as src moving only changed entries from src
+ * (src is consumed). Files with the same size and mtime or the same
+ * contents are not touched. If isBlobs is set, dst files can be
+ * symlinks to the blob storage: they are kept if the blob sha is the
+ * same as the sha of src file (cache is used to avoid hashing, cache
+ * key is the path relative to the vault root, relPath is dst path
+ * relative to it).
+ */
+Stats sync(QString const &src, QString const &dst, QString const &relPath
+           , bool isBlobs, hash::Cache *cache);
+
+}}
+
+#endif // _VAULT_STAGING_HPP_
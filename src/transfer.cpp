@@ -17,17 +17,23 @@
 #include "QString"
 #include "QVariant"
 #include "QMap"
+#include "QProcess"
+#include "QElapsedTimer"
+
+#include <algorithm>
 
 namespace os = qtaround::os;
 namespace subprocess = qtaround::subprocess;
 namespace error = qtaround::error;
 namespace debug = qtaround::debug;
-using qtaround::subprocess::Process;
-
 namespace {
 
 using vault::File;
 
+// tar gets this time to exit after SIGTERM
+const int terminateTimeout = 3000;
+// how often cancellation is checked while waiting for tar
+const int cancelPollInterval = 200;
 
 }
 
@@ -107,22 +113,61 @@ void CardTransfer::init(vault::Vault *v, Action action, QString const &dump_path
 }
 
 
-Process CardTransfer::doIO(IoCmd const &info)
+void CardTransfer::doIO(IoCmd const &info, QVariantMap const &err
+                        , vault::Cancel const &cancel)
 {
     debug::debug("Io", info);
-    Process ps;
+    QProcess ps;
     ps.start(info.get<Io::Exec>(), info.get<Io::Options>());
+    if (!ps.waitForStarted(-1))
+        error::raise(err, map({{"message", "Can't start"}
+                    , {"exec", info.get<Io::Exec>()}, {"error", ps.errorString()}}));
+
+    // waits not longer than timeout (ms, -1 - until process exits),
+    // process is terminated if transfer is cancelled
+    auto wait = [&ps, &cancel](int timeout) {
+        QElapsedTimer timer;
+        timer.start();
+        while (ps.state() != QProcess::NotRunning) {
+            if (cancel.isCancelled()) {
+                trace(Level::Info, "Cancelled, terminating", ps.program());
+                ps.terminate();
+                if (!ps.waitForFinished(terminateTimeout)) {
+                    ps.kill();
+                    ps.waitForFinished(-1);
+                }
+                cancel.check();
+            }
+            qint64 left = cancelPollInterval;
+            if (timeout >= 0) {
+                left = timeout - timer.elapsed();
+                if (left <= 0)
+                    return false;
+            }
+            ps.waitForFinished(std::min(left, qint64(cancelPollInterval)));
+        }
+        return true;
+    };
+    auto checkError = [&ps, &info, &err]() {
+        if (ps.exitStatus() != QProcess::NormalExit || ps.exitCode())
+            error::raise(err, map({{"message", "Process is failed"}
+                        , {"exec", info.get<Io::Exec>()}, {"rc", ps.exitCode()}
+                        , {"stderr", QString::fromUtf8(ps.readAllStandardError())}}));
+    };
+
     auto is_finished = false;
-    auto dst_size = 0;
+    double dst_size = 0;
     auto dtime = 1000;
+    auto reporter = info.get<Io::OnProgress>();
 
-    auto calculateDTime = [&info, dst_size](double dtime) {
+    // tar is not reporting progress, so it is measured as the size
+    // of the destination (kb)
+    auto calculateDTime = [&info, &dst_size, reporter](double dtime) {
         auto dst = info.get<Io::Dst>();
         auto dtime_now = dtime;
         auto dst_size_now = os::du(dst, {{"summarize", true}}).toDouble();
         auto dsize = dst_size_now - dst_size;
-        info.get<Io::OnProgress>()({{"type", "dst_size"}
-                , {"size", dst_size_now}});
+        reporter->set(0, qint64(dst_size_now) * 1024);
 
         if (info.get<Io::EstSize>() > 0 && dsize > 0) {
             auto size_fraction = dsize / info.get<Io::EstSize>();
@@ -140,17 +185,21 @@ Process CardTransfer::doIO(IoCmd const &info)
         return std::make_tuple(dtime_now, dst_size_now);
     };
 
-    if (!info.get<Io::OnProgress>()) {
-        ps.wait(-1);
-        return std::move(ps);
+    if (!reporter || !reporter->isEnabled()) {
+        wait(-1);
+        checkError();
+        return;
     }
 
-    is_finished = ps.wait(dtime);
+    reporter->setTotal(-1, qint64(info.get<Io::EstSize>()) * 1024);
+    is_finished = wait(dtime);
     while (!is_finished) {
         std::tie(dtime, dst_size) = calculateDTime(dtime);
-        is_finished = ps.wait(dtime);
+        is_finished = wait(dtime);
     }
-    return std::move(ps);
+    checkError();
+    calculateDTime(dtime);
+    reporter->flush();
 }
 
 void CardTransfer::estimateSpace()
@@ -208,16 +257,20 @@ void CardTransfer::validateDump(QString const &archive, QVariantMap const &err)
                     , {"dump", archive}}));
 }
 
-void CardTransfer::exportStorage(CardTransfer::progressCallback onProgress)
+void CardTransfer::exportStorage(CardTransfer::progressCallback onProgress
+                                 , vault::Cancel const &cancel)
 {
     auto tag_fname = vault::fileName(File::State);
     QStringList options = {"-cf", dst_, "-C", src_, ".git", tag_fname};
     onProgress({{"type", "stage"}, {"stage", "Copy"}});
     try {
-        IoCmd cmd("tar", options, onProgress, space_required_, dst_);
-        auto ps = doIO(cmd);
-        ps.check_error({{"reason", "Export"}});
+        vault::progress::Reporter reporter([&onProgress](vault::progress::Event const &e) {
+                onProgress(e.toMap());
+            }, vault::progress::Phase::Archive);
+        IoCmd cmd("tar", options, &reporter, space_required_, dst_);
+        doIO(cmd, {{"reason", "Export"}}, cancel);
 
+        cancel.check();
         onProgress({{"type", "stage"}, {"stage", "Flush"}});
         subprocess::check_call("sync", {}, {{"reason", "Export"}});
 
@@ -231,7 +284,8 @@ void CardTransfer::exportStorage(CardTransfer::progressCallback onProgress)
     }
 }
 
-void CardTransfer::importStorage(CardTransfer::progressCallback onProgress)
+void CardTransfer::importStorage(CardTransfer::progressCallback onProgress
+                                 , vault::Cancel const &cancel)
 {
     auto root = getVault()->root();
     if (dst_ != root)
@@ -244,6 +298,8 @@ void CardTransfer::importStorage(CardTransfer::progressCallback onProgress)
 
     onProgress({{"type", "stage"}, {"stage", "Validate"}});
     validateDump(src_, {{"reason", "BadSource"}});
+    // the last chance to keep the current vault
+    cancel.check();
     trace(Level::Info, "Clean destination tree");
     os::rmtree(dst_);
     invalidateVault();
@@ -255,9 +311,11 @@ void CardTransfer::importStorage(CardTransfer::progressCallback onProgress)
         os::mkdir(dst_);
         QStringList options = {"-xpf", src_, "-C", dst_};
         onProgress({{"type", "stage"}, {"stage", "Copy"}});
-        IoCmd cmd("tar", options, onProgress, space_required_, dst_);
-        auto res = doIO(cmd);
-        res.check_error({{"reason", "Archive"}});
+        vault::progress::Reporter reporter([&onProgress](vault::progress::Event const &e) {
+                onProgress(e.toMap());
+            }, vault::progress::Phase::Extract);
+        IoCmd cmd("tar", options, &reporter, space_required_, dst_);
+        doIO(cmd, {{"reason", "Archive"}}, cancel);
     } catch(...) {
         if (os::path::exists(dst_))
             os::rmtree(dst_);
@@ -265,7 +323,8 @@ void CardTransfer::importStorage(CardTransfer::progressCallback onProgress)
     }
 }
 
-void CardTransfer::execute(CardTransfer::progressCallback onProgress)
+void CardTransfer::execute(CardTransfer::progressCallback onProgress
+                           , vault::Cancel const &cancel)
 {
     trace(Level::Info, "Export/import", "action", str(action_));
 
@@ -279,10 +338,10 @@ void CardTransfer::execute(CardTransfer::progressCallback onProgress)
 
     switch (action_) {
     case Action::Export:
-        exportStorage(onProgress);
+        exportStorage(onProgress, cancel);
         break;
     case Action::Import:
-        importStorage(onProgress);
+        importStorage(onProgress, cancel);
         break;
     default:
         error::raise({{"reason", "Logic"}, {"message", "Unknown action"}
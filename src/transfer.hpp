@@ -10,6 +10,8 @@
 
 #include <qtaround/util.hpp>
 #include <qtaround/subprocess.hpp>
+#include <vault/progress.hpp>
+#include <vault/cancel.hpp>
 
 #include <QString>
 #include <QVariant>
@@ -19,7 +21,7 @@ enum class Io { Exec, Options, OnProgress, EstSize, Dst, EOE };
 template <> struct StructTraits<Io>
 {
     typedef std::tuple<QString, QStringList
-                       , std::function<void(QVariantMap &&)>
+                       , vault::progress::Reporter *
                        , long, QString> type;
 
     STRUCT_NAMES(Io, "Exec", "Options", "OnProgress", "EstSize", "Dst");
@@ -51,7 +53,9 @@ public:
 
     typedef std::function<void(QVariantMap&&)> progressCallback;
     void init(vault::Vault *, Action, QString const &);
-    void execute(progressCallback);
+    /// tar is terminated if transfer is cancelled, partial result is
+    /// removed
+    void execute(progressCallback, vault::Cancel const &cancel = vault::Cancel());
 
     inline QString getSrc() const { return src_; }
     inline QString getDst() const { return dst_; }
@@ -62,11 +66,12 @@ public:
 signals:
     void vaultChanged();
 private:
-    static qtaround::subprocess::Process doIO(IoCmd const &info);
+    static void doIO(IoCmd const &info, QVariantMap const &err
+                     , vault::Cancel const &cancel);
     static void validateDump(QString const &archive, QVariantMap const &err);
     void estimateSpace();
-    void exportStorage(progressCallback);
-    void importStorage(progressCallback);
+    void exportStorage(progressCallback, vault::Cancel const &);
+    void importStorage(progressCallback, vault::Cancel const &);
 
     vault::Vault *getVault();
     void invalidateVault();
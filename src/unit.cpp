@@ -7,6 +7,8 @@
  */
 
 #include <vault/unit.hpp>
+#include <vault/progress.hpp>
+#include "copy.hpp"
 
 #include <qtaround/util.hpp>
 #include <qtaround/os.hpp>
@@ -15,6 +17,8 @@
 
 #include <QString>
 
+#include <cstdio>
+
 namespace os = qtaround::os;
 namespace error = qtaround::error;
 namespace sys = qtaround::sys;
@@ -25,7 +29,6 @@ namespace debug = qtaround::debug;
 namespace vault { namespace unit {
 
 static const unsigned current_version = 1;
-static const QString default_preserve = "mode,ownership,timestamps";
 
 namespace {
 QVariantMap options_info
@@ -38,6 +41,15 @@ QVariantMap options_info
    , {"action", map({{"short", "a"}, {"long", "action"}
                 , {"required", true}, {"has_param", true}})}};
 
+// vault reads progress of the unit script from its stdout
+void print_progress(progress::Event const &event)
+{
+    auto line = event.toLine();
+    std::fwrite(line.constData(), 1, line.size(), stdout);
+    std::fputc('\n', stdout);
+    std::fflush(stdout);
+}
+
 class Config
 {
 public:
@@ -76,6 +88,8 @@ public:
         , context(c)
         , vault_dir({{"bin", options->value("bin-dir")}, {"data", options->value("dir")}})
         , home(os::path::canonical(options->value("home-dir")))
+        , reporter(print_progress, options->value("action") == "import"
+                   ? progress::Phase::Import : progress::Phase::Export)
     {
     }
 
@@ -145,6 +159,7 @@ private:
     map_type const &context;
     map_type vault_dir;
     QString home;
+    progress::Reporter reporter;
 };
 
 void create_dst_dirs(map_type const &item)
@@ -182,12 +197,10 @@ void Operation::to_vault(QString const &data_type
     auto link_info_path = get_link_info_fname(dst_root);
     Links links(read_links(dst_root), dst_root);
 
-    auto copy_entry = [dst_root](map_type const &info) {
+    auto copy_entry = [this, dst_root](map_type const &info) {
         debug::debug("COPY", info);
         auto dst = os::path::dirName(os::path::join(dst_root, str(info["path"])));
         auto src = str(info["full_path"]);
-        map_type options = {{"preserve", default_preserve}};
-        int (*fn)(QString const&, QString const&, map_type &&);
 
         if (!(os::path::isDir(dst) || os::mkdir(dst, {{ "parent", true }}))) {
             error::raise({{"msg", "Can't create destination in vault"}
@@ -195,13 +208,12 @@ void Operation::to_vault(QString const &data_type
         }
 
         if (os::path::isDir(src)) {
-            fn = &os::update_tree;
+            copy::tree(src, dst, copy::Preserve | copy::Update, &reporter);
         } else if (os::path::isFile(src)) {
-            fn = &os::cp;
+            copy::file(src, dst, copy::Preserve, &reporter);
         } else {
             error::raise({{"msg", "No handler for this entry type"}, {"path", src}});
         }
-        fn(src, dst, std::move(options));
     };
 
     auto process_symlink = [this, &links](map_type &v) {
@@ -258,6 +270,10 @@ void Operation::to_vault(QString const &data_type
         if (is_src_exists(*it))
             existing_paths.push_back(*it);
     }
+    for (auto const &info : existing_paths) {
+        auto size = copy::size(str(info["full_path"]));
+        reporter.addTotal(size.files, size.bytes);
+    }
     std::for_each(existing_paths.begin(), existing_paths.end(), copy_entry);
     links.save();
     version(dst_root).save();
@@ -292,8 +308,8 @@ void Operation::from_vault(QString const &data_type
             if (!os::mkdir(dst, {{"parent", true}}))
                 error::raise({{"msg", "Can't create directory"}, {"dir", dst}});
         }
-        os::update_tree(os::path::join(src_root, "."), dst
-                        , {{"preserve", default_preserve}, {"deref", true}});
+        copy::tree(os::path::join(src_root, "."), dst
+                   , copy::Preserve | copy::Deref | copy::Update);
     };
 
     auto process_absent_and_links = [src_root, &links](map_type &item) {
@@ -357,6 +373,13 @@ void Operation::from_vault(QString const &data_type
     items.append(linked_items);
     debug::debug("LINKED+", items);
 
+    for (auto const &item : items) {
+        if (is(item["skip"]))
+            continue;
+        auto size = copy::size(str(item["src"]), copy::Deref);
+        reporter.addTotal(size.files, size.bytes);
+    }
+
     for (auto it = items.begin(); it != items.end(); ++it) {
         auto &item = *it;
         QString src, dst_dir, dst;
@@ -367,7 +390,7 @@ void Operation::from_vault(QString const &data_type
         bool overwrite;
         std::function<void()> fn;
 
-        map_type options = {{"preserve", default_preserve}, {"deref", true}};
+        int flags = copy::Preserve | copy::Deref;
         {
             auto v = item["overwrite"];
             overwrite = v.isValid() ? is(v) : overwrite_default;
@@ -380,29 +403,21 @@ void Operation::from_vault(QString const &data_type
             dst = os::path::canonical(str(item["full_path"]));
             dst_dir = os::path::dirName(dst);
             src = os::path::canonical(src);
-            if (overwrite) {
-                options["force"] = true;
-                fn = [src, dst, dst_dir, &options]() {
-                    os::cptree(src, dst_dir, std::move(options));
-                };
-            } else {
-                fn = [src, dst, dst_dir, &options]() {
-                    os::update_tree(src, dst_dir, std::move(options));
-                };
-            }
+            flags |= overwrite ? copy::Force : copy::Update;
+            fn = [this, src, dst_dir, flags]() {
+                copy::tree(src, dst_dir, flags, &reporter);
+            };
         } else if (os::path::isFile(src)) {
             dst = str(item["full_path"]);
-            dst_dir = os::path::dirName(dst);
 
             if (overwrite) {
-                options["force"] = true;
-                fn = [src, dst, dst_dir, &options]() {
+                fn = [this, src, dst, flags]() {
                     os::unlink(dst);
-                    os::cp(src, dst_dir, std::move(options));
+                    copy::file(src, dst, flags | copy::Force, &reporter);
                 };
             } else {
-                fn = [src, dst, &options]() {
-                    os::cp(src, dst, std::move(options));
+                fn = [this, src, dst, flags]() {
+                    copy::file(src, dst, flags, &reporter);
                 };
             }
         }
@@ -476,6 +491,7 @@ void Operation::execute()
             error::raise({{"msg", "Unknown context item"}, {"item", name}});
         }
     };
+    reporter.flush();
 
 }
 
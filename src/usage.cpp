@@ -0,0 +1,240 @@
+/**
+ * @file usage.cpp
+ * @brief Space accounting for snapshots
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "usage.hpp"
+#include "blobs.hpp"
+#include "git.hpp"
+
+#include <qtaround/os.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+#include <QSaveFile>
+#include <QList>
+#include <QSet>
+
+namespace os = qtaround::os;
+namespace debug = qtaround::debug;
+
+namespace vault { namespace usage {
+
+namespace {
+
+struct BlobRef
+{
+    QByteArray sha;
+    qint64 size;
+    qint64 stored;
+};
+
+struct TreeInfo
+{
+    TreeInfo() : data(0) {}
+    qint64 data; // size of files stored in git
+    QList<BlobRef> blobs;
+};
+
+typedef QHash<QByteArray, TreeInfo> Trees;
+
+// <tree> SP <data size> SP <blobs count> LF
+// <blob> SP <size> SP <stored> LF (blobs count lines)
+Trees load(QString const &fname)
+{
+    Trees res;
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return res;
+    while (!file.atEnd()) {
+        auto header = file.readLine().trimmed().split(' ');
+        if (header.size() != 3)
+            break;
+        TreeInfo info;
+        info.data = header[1].toLongLong();
+        auto count = header[2].toInt();
+        for (int i = 0; i < count && !file.atEnd(); ++i) {
+            auto fields = file.readLine().trimmed().split(' ');
+            if (fields.size() == 3)
+                info.blobs.push_back({fields[0], fields[1].toLongLong(), fields[2].toLongLong()});
+        }
+        res.insert(header[0], info);
+    }
+    return res;
+}
+
+void save(QString const &fname, Trees const &trees)
+{
+    QSaveFile file(fname);
+    if (!file.open(QIODevice::WriteOnly)) {
+        debug::warning("Can't save trees cache", fname);
+        return;
+    }
+    for (auto it = trees.begin(); it != trees.end(); ++it) {
+        auto const &info = it.value();
+        file.write(it.key() + ' ' + QByteArray::number(info.data)
+                   + ' ' + QByteArray::number(info.blobs.size()) + '\n');
+        for (auto const &blob : info.blobs)
+            file.write(blob.sha + ' ' + QByteArray::number(blob.size)
+                       + ' ' + QByteArray::number(blob.stored) + '\n');
+    }
+    if (!file.commit())
+        debug::warning("Can't save trees cache", fname);
+}
+
+TreeInfo list(QString const &repo, QByteArray const &tree, blobs::Storage const &storage)
+{
+    TreeInfo res;
+    QList<QByteArray> links;
+    QList<qint64> linkSizes;
+    for (auto const &e : git::lsTree(repo, tree, true, true)) {
+        if (e.isSymLink()) {
+            links.push_back(e.sha);
+            linkSizes.push_back(e.size);
+        } else if (e.size > 0) {
+            res.data += e.size;
+        }
+    }
+    auto targets = git::catFiles(repo, links);
+    for (int i = 0; i < targets.size(); ++i) {
+        auto const &target = targets[i];
+        // blob links are pointing to .git/blobs/<2>/<38>
+        auto sha = target.contains(".git/blobs/")
+            ? blobs::Storage::shaOf(QString::fromUtf8(target)) : QByteArray();
+        if (sha.isEmpty()) {
+            res.data += linkSizes[i];
+            continue;
+        }
+        auto size = storage.sizeOf(sha);
+        if (!size.isValid()) {
+            debug::warning("Blob is absent", sha);
+            size.size = size.stored = 0;
+        }
+        res.blobs.push_back({sha, size.size, size.stored});
+    }
+    return res;
+}
+
+}
+
+struct Accounting::Data
+{
+    QList<QByteArray> commits;
+    // unit trees of each commit and commits using each unit tree
+    QList<QSet<QByteArray> > commitTrees;
+    QHash<QByteArray, QList<int> > users;
+    Trees trees;
+};
+
+Accounting::Accounting(QString const &repo, blobs::Storage const &storage)
+    : m(new Data())
+{
+    QList<QByteArray> rootTrees;
+    QSet<QByteArray> seen;
+    for (auto const &commit : git::roots(repo)) {
+        if (seen.contains(commit))
+            continue;
+        seen.insert(commit);
+        m->commits.push_back(commit);
+        rootTrees.push_back(commit + "^{tree}");
+    }
+    auto rootData = git::catFiles(repo, rootTrees);
+
+    for (int i = 0; i < m->commits.size(); ++i) {
+        QSet<QByteArray> trees;
+        for (auto const &e : git::parseTree(rootData[i])) {
+            if (e.isTree() && !e.path.startsWith('.'))
+                trees.insert(e.sha);
+        }
+        for (auto const &tree : trees)
+            m->users[tree].push_back(i);
+        m->commitTrees.push_back(trees);
+    }
+
+    auto cacheName = os::path::join(repo, ".git", "vault.trees");
+    auto cached = load(cacheName);
+    bool isChanged = false;
+    for (auto it = m->users.begin(); it != m->users.end(); ++it) {
+        auto found = cached.find(it.key());
+        if (found != cached.end()) {
+            m->trees.insert(it.key(), found.value());
+        } else {
+            m->trees.insert(it.key(), list(repo, it.key(), storage));
+            isChanged = true;
+        }
+    }
+    // trees of removed snapshots are dropped
+    if (isChanged || m->trees.size() != cached.size())
+        save(cacheName, m->trees);
+}
+
+Accounting::~Accounting()
+{
+}
+
+QHash<QByteArray, Sizes> Accounting::sizes() const
+{
+    // blob owner: index of the only commit referencing it or -1 if
+    // it is shared
+    QHash<QByteArray, int> owners;
+    QHash<QByteArray, qint64> stored;
+    for (auto it = m->users.begin(); it != m->users.end(); ++it) {
+        auto const &commitsUsing = it.value();
+        auto owner = commitsUsing.size() == 1 ? commitsUsing[0] : -1;
+        for (auto const &blob : m->trees[it.key()].blobs) {
+            auto found = owners.find(blob.sha);
+            if (found == owners.end()) {
+                owners.insert(blob.sha, owner);
+                stored.insert(blob.sha, blob.stored);
+            } else if (found.value() != owner) {
+                found.value() = -1;
+            }
+        }
+    }
+
+    QList<Sizes> sizes;
+    for (int i = 0; i < m->commits.size(); ++i) {
+        Sizes s;
+        for (auto const &tree : m->commitTrees[i]) {
+            auto const &info = m->trees[tree];
+            s.size += info.data;
+            for (auto const &blob : info.blobs)
+                s.size += blob.size;
+        }
+        sizes.push_back(s);
+    }
+    for (auto it = owners.begin(); it != owners.end(); ++it) {
+        if (it.value() >= 0)
+            sizes[it.value()].unique += stored[it.key()];
+    }
+
+    QHash<QByteArray, Sizes> res;
+    for (int i = 0; i < m->commits.size(); ++i)
+        res.insert(m->commits[i], sizes[i]);
+    return res;
+}
+
+qint64 Accounting::stored(QSet<QByteArray> const &commits) const
+{
+    QSet<QByteArray> trees;
+    for (int i = 0; i < m->commits.size(); ++i) {
+        if (commits.contains(m->commits[i]))
+            trees.unite(m->commitTrees[i]);
+    }
+    qint64 res = 0;
+    QSet<QByteArray> blobs;
+    for (auto const &tree : trees) {
+        for (auto const &blob : m->trees[tree].blobs) {
+            if (blobs.contains(blob.sha))
+                continue;
+            blobs.insert(blob.sha);
+            res += blob.stored;
+        }
+    }
+    return res;
+}
+
+}}
@@ -0,0 +1,63 @@
+#ifndef _VAULT_USAGE_HPP_
+#define _VAULT_USAGE_HPP_
+/**
+ * @file usage.hpp
+ * @brief Space accounting for snapshots
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+#include <memory>
+
+namespace vault {
+
+namespace blobs { class Storage; }
+
+namespace usage {
+
+struct Sizes
+{
+    Sizes() : size(0), unique(0) {}
+    qint64 size; // logical size of units data and blobs
+    qint64 unique; // storage bytes used only by this commit
+};
+
+/**
+ * Accounting of all commits blobs storage is referenced from
+ * (snapshot tags, the same roots are used by blobs::Collector), so
+ * unique bytes of the snapshot are freed by gc after the snapshot
+ * removal. Master is not an owner: it points to the newest snapshot
+ * and is returned to the remaining one by Vault::gc(). Units trees are immutable, so data size and blobs of each
+ * unit tree are cached in .git/vault.trees and only trees appeared
+ * since the last run are listed.
+ */
+class Accounting
+{
+public:
+    Accounting(QString const &repo, blobs::Storage const &storage);
+    ~Accounting();
+
+    /// commit -> sizes for all roots
+    QHash<QByteArray, Sizes> sizes() const;
+    /// storage bytes referenced by commits (they should be roots)
+    qint64 stored(QSet<QByteArray> const &commits) const;
+
+private:
+    struct Data;
+    std::unique_ptr<Data> m;
+};
+
+inline QHash<QByteArray, Sizes> compute(QString const &repo, blobs::Storage const &storage)
+{
+    return Accounting(repo, storage).sizes();
+}
+
+}}
+
+#endif // _VAULT_USAGE_HPP_
@@ -39,6 +39,8 @@ int main_(int argc, char **argv)
     parser.addOption(QCommandLineOption(QStringList() << "g" << "git-config", "git-config", "git-config"));
     parser.addOption(QCommandLineOption(QStringList() << "m" << "message", "message", "message"));
     parser.addOption(QCommandLineOption(QStringList() << "t" << "tag", "tag", "tag"));
+    parser.addOption(QCommandLineOption(QStringList() << "b" << "budget", "time budget, ms", "budget"));
+    parser.addOption(QCommandLineOption(QStringList() << "o" << "output", "output dir", "output"));
 
     parser.process(app);
 
@@ -52,6 +54,8 @@ int main_(int argc, char **argv)
     set(options, parser, "git-config", true);
     set(options, parser, "message", true);
     set(options, parser, "tag", true);
+    set(options, parser, "budget", true);
+    set(options, parser, "output", true);
 
     options.insert("global", parser.isSet("global"));
 
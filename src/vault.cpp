@@ -12,22 +12,41 @@
 #include <qtaround/os.hpp>
 #include <qtaround/error.hpp>
 #include <qtaround/debug.hpp>
-#include <qtaround/subprocess.hpp>
+#include <qtaround/json.hpp>
+
+#include "hash.hpp"
+#include "blobs.hpp"
+#include "git.hpp"
+#include "gc.hpp"
+#include "scheduler.hpp"
+#include "fingerprint.hpp"
+#include "staging.hpp"
+#include "repo.hpp"
+#include "catalog.hpp"
+#include "retention.hpp"
+#include "usage.hpp"
+#include "diff.hpp"
+#include "script.hpp"
 
 #include <gittin/commit.hpp>
 #include <gittin/branch.hpp>
-#include <gittin/repostatus.hpp>
 
 #include <QFile>
+#include <QSaveFile>
+#include <QBuffer>
 #include <QTextStream>
 #include <QDebug>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QDir>
 
+#include <algorithm>
+#include <memory>
+
 namespace os = qtaround::os;
-namespace subprocess = qtaround::subprocess;
 namespace error = qtaround::error;
 namespace debug = qtaround::debug;
+namespace json = qtaround::json;
 
 
 namespace vault {
@@ -37,6 +56,11 @@ static const QMap<File, QString> fileNames = {
     , {File::VersionTree, ".vault"}
     , {File::VersionRepo, os::path::join(".git", "vault.version")}
     , {File::State, ".vault.state"}
+    , {File::HashCache, os::path::join(".git", "vault.hashcache")}
+    , {File::Durations, os::path::join(".git", "vault.durations")}
+    // not .units: it is the excluded local units config dir
+    , {File::Units, ".units.json"}
+    , {File::Fingerprints, os::path::join(".git", "vault.fingerprints")}
 };
 
 QString fileName(File id)
@@ -53,11 +77,32 @@ namespace version {
     static const int repository = 2;
 }
 
+// blobs of this size and bigger are split into content-defined chunks
+static const qint64 defaultChunkThreshold = 64 * 1024 * 1024;
+
+// optional packing of small blobs
+static const qint64 defaultPackMaxBlobSize = 1024 * 1024;
+static const qint64 defaultPackMaxPacks = 16;
+
+// optional zstd compression of loose blobs
+static const qint64 defaultCompressLevel = 3;
+
+// units scripts are mostly waiting for i/o, so they are run
+// concurrently by default
+static const qint64 defaultJobs = 4;
+
 Snapshot::Snapshot(const Gittin::Tag &tag)
         : m_tag(tag)
 {
 }
 
+Snapshot::Snapshot(const Gittin::Tag &tag, const QVariantMap &info, const QString &repo)
+        : m_tag(tag)
+        , m_info(info)
+        , m_repo(repo)
+{
+}
+
 QString Snapshot::name() const
 {
     return m_tag.name().mid(1);
@@ -65,7 +110,20 @@ QString Snapshot::name() const
 
 void Snapshot::remove()
 {
+    if (m_repo.isEmpty()) {
+        // catalog will notice tags change and will be rebuilt
+        m_tag.destroy();
+        return;
+    }
+    catalog::Catalog snapshots(m_repo);
+    snapshots.refresh();
+    auto tag = m_tag.name();
     m_tag.destroy();
+    snapshots.remove(tag);
+    // blobs shared with the removed snapshot can become unique
+    snapshots.updateSizes();
+    if (!snapshots.save())
+        debug::warning("Can't update snapshots catalog");
 }
 
 
@@ -168,12 +226,59 @@ int Vault::execute(const QVariantMap &options)
         return unitsResult(vault.restore
                            (vault.snapshot(options.value("tag").toByteArray())
                             , options.value("home").toString(), units));
+    } else if (action == "extract") {
+        if (!options.contains("tag") || units.size() != 1 || !options.contains("output")) {
+            error::raise({{"action", action}
+                    , {"msg", "tag, single unit and output dir should be provided"}});
+        }
+        auto paths = str(options.value("data")).split(",", QString::SkipEmptyParts);
+        vault.extract(vault.snapshot(options.value("tag").toByteArray())
+                      , units.first(), paths, options.value("output").toString());
+    } else if (action == "diff") {
+        // <from>[,<to>], the current state of units is used if there
+        // is no <to>
+        auto tags = str(options.value("tag")).split(",", QString::SkipEmptyParts);
+        if (tags.isEmpty() || tags.size() > 2) {
+            error::raise({{"action", action}, {"msg", "1 or 2 tags should be provided"}});
+        }
+        auto from = vault.snapshot(tags[0].toUtf8());
+        auto changes = tags.size() == 2
+            ? vault.diff(from, vault.snapshot(tags[1].toUtf8()), units)
+            : vault.diff(from, options.value("home").toString(), units);
+        // <A|D|M> <unit>/<path> <old size> <new size>
+        QTextStream cout{stdout};
+        Diff::Change change;
+        while (changes.next(change)) {
+            auto type = change.type == Diff::Change::Type::Added ? 'A'
+                : change.type == Diff::Change::Type::Removed ? 'D' : 'M';
+            cout << type << ' ' << change.unit << '/' << change.path << ' '
+                 << change.oldSize << ' ' << change.newSize << '\n';
+        }
+    } else if (action == "gc") {
+        auto budget = options.contains("budget") ? options.value("budget").toInt() : -1;
+        return vault.gc(budget) ? 0 : 2;
+    } else if (action == "pack") {
+        vault.pack();
+    } else if (action == "prune") {
+        // policy from config is used if there is no data
+        auto removed = vault.prune(parseKvPairs(options.value("data").toString()));
+        QTextStream cout{stdout};
+        for (auto const &tag : removed)
+            cout << tag << '\n';
     } else if (action == "list-snapshots") {
         auto snapshots = vault.snapshots();
         QTextStream cout{stdout};
         for (const Snapshot &s: snapshots) {
             cout << s.tag().name() << '\n';
         }
+    } else if (action == "snapshot-sizes") {
+        // <tag> <size> <added> <unique>, bytes, -1 if unknown
+        auto snapshots = vault.snapshots();
+        QTextStream cout{stdout};
+        for (const Snapshot &s: snapshots) {
+            cout << s.tag().name() << ' ' << s.size() << ' ' << s.addedSize()
+                 << ' ' << s.uniqueSize() << '\n';
+        }
     } else if (action == "register") {
         if (!options.contains("data")) {
             error::raise({{"action", action}, {"msg", "Needs data"}});
@@ -374,9 +479,277 @@ bool Vault::ensureValid()
     return true;
 }
 
-Vault::Result Vault::backup(const QString &home, const QStringList &units, const QString &message, const ProgressCallback &callback)
+struct Unit
+{
+    Unit(const QString &unit, const QString &home, Gittin::Repo *vcs
+         , const config::Unit &config, blobs::Storage *storage
+         , hash::Cache *cache = nullptr)
+        : m_home(home)
+        , m_unit(unit)
+        , m_root(QDir(os::path::join(vcs->path(), unit)))
+        , m_vcs(vcs)
+        , m_config(config)
+        , m_storage(storage)
+        , m_cache(cache)
+        , m_index(nullptr)
+        , m_changed(false)
+        , m_skipped(false)
+    {
+        m_blobs = os::path::join(m_root.absolutePath(), "blobs");
+        m_data = os::path::join(m_root.absolutePath(), "data");
+    }
+
+    script::Options scriptOptions() const
+    {
+        auto options = m_script;
+        if (m_config.timeout() > 0)
+            options.timeout = m_config.timeout() * 1000;
+        return options;
+    }
+
+    void execScript(const QString &action, const QString &data, const QString &blobs)
+    {
+        QString script = m_config.script();
+        debug::info("SCRIPT>>>", script, "action", action);
+        if (!QFileInfo(script).isExecutable()) {
+            error::raise({{"msg", "Should be executable"}, {"script", script}});
+        }
+        QStringList args = { "--action", action,
+                             "--dir", QDir(data).absolutePath(),
+                             "--bin-dir", QDir(blobs).absolutePath(),
+                             "--home-dir", m_home };
+
+        // output is captured while script is running, only its tail
+        // is kept
+        auto ps = script::run(m_unit, script, args, scriptOptions());
+
+        auto isFailed = ps.rc || ps.isTimedOut || ps.isCancelled;
+        debug::Level level = isFailed ? debug::Level::Error : debug::Level::Info;
+
+        debug::print_ge(level, "RC", ps.rc);
+        debug::print_ge(level, "STDOUT", ps.out);
+        debug::print_ge(level, "<<STDOUT");
+        debug::print_ge(level, "STDERR", ps.err);
+        debug::print_ge(level, "<<STDERR");
+        debug::print_ge(level, "<<<SCRIPT", script, "action", action, "is done");
+        if (ps.isCancelled) {
+            error::raise({{"msg", "Script " + script + " is cancelled"}, {"reason", "cancelled"}
+                    , {"stdout", ps.out}, {"stderr", ps.err}});
+        }
+        if (ps.isTimedOut) {
+            error::raise({{"msg", "Script " + script + " is timed out"}, {"reason", "timeout"}
+                    , {"stdout", ps.out}, {"stderr", ps.err}});
+        }
+        if (ps.rc) {
+            QString msg = "Backup script " + script + " exited with rc=" + QString::number(ps.rc);
+            error::raise({{"msg", msg}, {"stdout", ps.out}, {"stderr", ps.err}});
+        }
+    }
+
+    void linkBlob(const QString &file, const QByteArray &sha, QStringList &index)
+    {
+        QString linkFName = os::path::join(m_vcs->path(), file);
+        QString blobFName = m_storage->add(linkFName, sha);
+        QString target = os::path::relative(blobFName, os::path::dirName(linkFName));
+        os::symlink(target, linkFName);
+        if (!os::path::isSymLink(linkFName)) {
+            error::raise({{"msg", "Blob should be symlinked"},
+                          {"link", linkFName}, {"target", target}});
+        }
+        index << file;
+    }
+
+    // export is done by the unit script in the unit directory, it can
+    // be run concurrently with other units. Script is not executed if
+    // fingerprint of unit inputs is the same as after the last backup
+    void exportData(const QByteArray &lastFingerprint)
+    {
+        m_fingerprint = fingerprint::compute(m_home, m_config, scriptOptions());
+        if (!m_fingerprint.isEmpty() && m_fingerprint == lastFingerprint) {
+            debug::info("Inputs are not changed, skipping export of", m_unit);
+            m_skipped = true;
+            return;
+        }
+
+        if (!m_staging.isEmpty()) {
+            exportStaged();
+            return;
+        }
+
+        // cleanup directories for data and blobs in
+        // the repository
+        os::rmtree(m_blobs);
+        os::rmtree(m_data);
+        os::mkdir(m_root.absolutePath());
+        os::mkdir(m_blobs);
+        os::mkdir(m_data);
+
+        execScript("export", m_data, m_blobs);
+    }
+
+    // unit exports into the scratch area, only changed entries are
+    // moved into the tracked tree, so git and linkBlob() see only
+    // them
+    void exportStaged()
+    {
+        auto data = os::path::join(m_staging, "data");
+        auto blobs = os::path::join(m_staging, "blobs");
+        os::rmtree(m_staging);
+        if (!os::mkdir(data, {{"parent", true}}) || !os::mkdir(blobs))
+            error::raise({{"msg", "Can't create staging dir"}, {"dir", m_staging}});
+
+        execScript("export", data, blobs);
+
+        staging::sync(data, m_data, os::path::join(m_unit, "data"), false, nullptr);
+        staging::sync(blobs, m_blobs, os::path::join(m_unit, "blobs"), true, m_cache);
+        os::rmtree(m_staging);
+    }
+
+    // exported data are added to git and blob storage, not thread-safe
+    void backup()
+    {
+        // cancelled unit is rolled back by the caller
+        m_script.cancel.check();
+        QString name = m_config.name();
+
+        auto changes = m_index->status(os::path::join(m_root.path(), "blobs"));
+        QStringList blobs;
+        // index is updated at once for all blobs
+        QStringList index;
+        for (auto const &file: changes) {
+            if (file.index == ' ' && file.workTree == 'D') {
+                index << file.path;
+                continue;
+            }
+
+            QString fname = QFileInfo(file.path).fileName();
+            QString prefix = config::prefix;
+            if (fname.length() >= prefix.length() && fname.startsWith(prefix)) {
+                index << file.path;
+                continue;
+            }
+
+            blobs << file.path;
+        }
+
+        // blobs unchanged since the last backup are taken from the
+        // cache, the rest is hashed at once, in parallel
+        QList<QByteArray> shas;
+        QList<hash::Stat> stats;
+        QStringList toHash;
+        qint64 toHashSize = 0;
+        for (const QString &file: blobs) {
+            auto path = os::path::join(m_vcs->path(), file);
+            auto st = hash::stat(path);
+            auto sha = m_cache ? m_cache->get(file, st) : QByteArray();
+            if (sha.isEmpty()) {
+                toHash << path;
+                toHashSize += std::max(st.size, qint64(0));
+            }
+            stats << st;
+            shas << sha;
+        }
+        debug::debug("Blobs to hash", toHash.size(), "of", blobs.size());
+        progress::Reporter reporter(m_events, progress::Phase::Hash, m_unit);
+        reporter.setTotal(toHash.size(), toHashSize);
+        auto hashed = hash::blobs(toHash, 0, &reporter);
+        if (!toHash.isEmpty())
+            reporter.flush();
+        for (int i = 0; i < blobs.size(); ++i) {
+            auto const &file = blobs.at(i);
+            if (shas.at(i).isEmpty()) {
+                shas[i] = hashed.value(os::path::join(m_vcs->path(), file));
+                if (m_cache)
+                    m_cache->put(file, stats.at(i), shas.at(i));
+            }
+            linkBlob(file, shas.at(i), index);
+        }
+        m_index->update(index);
+        if (m_cache)
+            m_cache->forgetUnused(m_unit + "/");
+
+        // add all only in data dir to avoid blobs to get into git
+        // objects storage. Changes are only staged, all units are
+        // committed at once by Vault::backup
+        m_index->addAll(os::path::join(m_root.path(), "data"));
+        changes = m_index->status(m_root.path());
+        if (repo::isDirty(changes)) {
+            error::raise({{"msg", "Dirty tree"}, {"dir", m_root.path()}/*, {"status", status_dump(status)}*/});
+        }
+        m_changed = !changes.isEmpty();
+        if (!m_changed)
+            debug::info("Nothing to backup for ", name);
+    }
+
+    // unit tree of the snapshot is checked out into the scratch
+    // area, so the vault worktree is not touched. Chunked, packed or
+    // compressed blobs are assembled before the import, not
+    // thread-safe
+    void prepareImport(const QByteArray &tree)
+    {
+        if (tree.isEmpty()) {
+            error::raise({{"reason", "absent"}, {"name", m_unit}});
+        }
+        os::rmtree(m_staging);
+        git::checkoutTree(m_vcs->path(), tree, m_staging);
+        m_data = os::path::join(m_staging, "data");
+        m_blobs = os::path::join(m_staging, "blobs");
+        // empty dirs are not stored in git
+        os::mkdir(m_data, {{"parent", true}});
+        os::mkdir(m_blobs, {{"parent", true}});
+        blobs::relinkTree(*m_storage, m_blobs);
+        progress::Reporter reporter(m_events, progress::Phase::Materialize, m_unit);
+        auto count = blobs::materializeTree(*m_storage, m_blobs, &reporter);
+        debug::debug("Materialized", count, "blobs for", m_unit);
+        if (count)
+            reporter.flush();
+    }
+
+    void importData()
+    {
+        execScript("import", m_data, m_blobs);
+    }
+
+    QString m_home;
+    QString m_unit;
+    QDir m_root;
+    Gittin::Repo *m_vcs;
+    // used only by backup()
+    repo::Backend *m_index;
+    QString m_blobs;
+    QString m_data;
+    config::Unit m_config;
+    blobs::Storage *m_storage;
+    hash::Cache *m_cache;
+    bool m_changed;
+    bool m_skipped;
+    QByteArray m_fingerprint;
+    QString m_staging;
+    script::Options m_script;
+    progress::Callback m_events;
+};
+
+// unit scripts can report structured progress events (see
+// progress::Event::toLine) or free-form status lines
+static void scriptProgress(const QString &unit, const QString &line
+                           , const Vault::ProgressCallback &callback
+                           , const progress::Callback &events)
+{
+    progress::Event event;
+    if (!progress::Event::fromLine(line, event)) {
+        callback(unit, line);
+    } else if (events) {
+        event.unit = unit;
+        events(event);
+    }
+}
+
+Vault::Result Vault::backup(const QString &home, const QStringList &units, const QString &message, const ProgressCallback &callback
+                            , const progress::Callback &events, const Cancel &cancel)
 {
     debug::info("Backup units", units, ", home", home);
+    QElapsedTimer timer;
+    timer.start();
     Result res;
     res.failedUnits << units;
 
@@ -399,11 +772,96 @@ Vault::Result Vault::backup(const QString &home, const QStringList &units, const
             usedUnits << i.key();
         }
     }
+    hash::Cache cache(absolutePath(fileName(File::HashCache)));
+    cache.load();
+    blobs::Storage storage(m_blobStorage);
+    storage.setChunkThreshold(git::config(m_path, "vault.chunkThreshold"
+                                          , defaultChunkThreshold));
+    if (git::config(m_path, "vault.compress") == "true") {
+        storage.setCompression(git::config(m_path, "vault.compressLevel", defaultCompressLevel)
+                               , git::config(m_path, "vault.compressThreads", qint64(0)));
+    }
+    scheduler::Durations durations(absolutePath(fileName(File::Durations)));
+    durations.load();
+    scheduler::Scheduler jobs(git::config(m_path, "vault.jobs", defaultJobs));
+    // fingerprint is valid only for the unit tree it was recorded
+    // with, so it is stored as <fingerprint>:<tree sha>
+    fingerprint::Store fingerprints(absolutePath(fileName(File::Fingerprints)));
+    fingerprints.load();
+    auto unitTrees = [this]() {
+        QMap<QString, QByteArray> res;
+        for (auto const &e : git::lsTree(m_path, "HEAD", false)) {
+            if (e.isTree())
+                res.insert(e.path, e.sha);
+        }
+        return res;
+    };
+    auto trees = unitTrees();
+    QMap<QString, QByteArray> newFingerprints;
+
+    auto objectsSize = git::objectsSize(m_path);
+    auto isStaged = (git::config(m_path, "vault.staging") != "false");
+    // repository is kept open by in-process backend during backup
+    auto index = repo::create(m_path);
+    debug::debug("Git backend", index->name());
+    QMap<QString, std::shared_ptr<Unit> > started;
+    QVariantMap unitsInfo;
+    auto scriptOptions = script::Options::fromConfig(m_path);
     for (const QString &unit: usedUnits) {
-        if (backupUnit(home, unit, progress)) {
+        auto u = std::make_shared<Unit>(unit, home, &m_vcs, config().units().value(unit)
+                                        , &storage, &cache);
+        if (isStaged)
+            u->m_staging = os::path::join(m_path, ".git", "vault.staging", unit);
+        u->m_index = index.get();
+        u->m_events = events;
+        u->m_script = scriptOptions;
+        u->m_script.cancel = cancel;
+        // progress is reported from the scheduler thread
+        u->m_script.onProgress = [&jobs, &progress, &events, unit](const QString &status) {
+            jobs.post([&progress, &events, unit, status]() {
+                    scriptProgress(unit, status, progress, events);
+                });
+        };
+        started.insert(unit, u);
+        auto last = fingerprints.get(unit);
+        auto tree = trees.value(unit);
+        auto lastFingerprint = (tree.isEmpty() || !last.endsWith(':' + tree))
+            ? QByteArray() : last.left(last.size() - tree.size() - 1);
+        jobs.add(unit, [u, lastFingerprint]() { u->exportData(lastFingerprint); }
+                 , durations.get("export/" + unit));
+    }
+    auto onStart = [&progress, &cancel](const QString &unit) {
+        debug::info("Backup unit", unit);
+        if (unit.isEmpty())
+            error::raise({{"msg", "Trying to backup unit w/o name"}});
+        // pending units are not started after cancellation
+        cancel.check();
+        progress(unit, "begin");
+    };
+    // exported data is added to git by one unit at a time
+    auto onDone = [&](const QString &unit, qint64 elapsed, std::exception_ptr exportError) {
+        auto u = started[unit];
+        if (!exportError && !u->m_skipped)
+            durations.set("export/" + unit, elapsed);
+        fingerprints.remove(unit);
+        if (backupUnit(*u, exportError, progress)) {
             res.failedUnits.removeOne(unit);
             res.succededUnits << unit;
+            unitsInfo[unit] = QVariantMap({{"changed", u->m_changed}
+                                           , {"skipped", u->m_skipped}
+                                           , {"duration", elapsed}});
+            if (!u->m_fingerprint.isEmpty())
+                newFingerprints.insert(unit, u->m_fingerprint);
         }
+        started.remove(unit);
+    };
+    jobs.run(onStart, onDone);
+    cache.save();
+    durations.save();
+
+    if (!cancel.isCancelled() && git::config(m_path, "vault.pack") == "true") {
+        storage.pack(git::config(m_path, "vault.packMaxBlobSize", defaultPackMaxBlobSize)
+                     , git::config(m_path, "vault.packMaxPacks", defaultPackMaxPacks));
     }
 
     if (res.succededUnits.size()) {
@@ -411,13 +869,48 @@ Vault::Result Vault::backup(const QString &home, const QStringList &units, const
         qDebug()<<timeTag<<message;
         QString msg = message.isEmpty() ? timeTag : message + '\n' + timeTag;
         writeFile(fileName(File::Message), msg);
+        if (json::write(unitsInfo, absolutePath(fileName(File::Units))) <= 0)
+            error::raise({{"msg", "Can't write units info"}
+                    , {"path", fileName(File::Units)}});
         m_vcs.add(fileName(File::Message));
+        m_vcs.add(fileName(File::Units));
+        // catalog is loaded before the new tag is created, so it is
+        // not rebuilt
+        auto &snapshots = catalog();
+        // single commit for all units staged during backup
         Gittin::Commit commit = m_vcs.commit(timeTag + '\n' + msg);
         commit.addNote(message);
         tagSnapshot(timeTag);
+
+        catalog::Entry entry;
+        entry.tag = QLatin1String(">") + timeTag;
+        entry.commit = QString(commit.sha()).toLatin1();
+        // the same time as the rebuilt catalog has
+        entry.timestamp = git::output(m_path, {"show", "-s", "--format=%ct"
+                    , QString::fromLatin1(entry.commit)})
+            .trimmed().toLongLong();
+        entry.message = message;
+        entry.units = unitsInfo;
+        entry.duration = timer.elapsed();
+        entry.added = storage.addedBytes()
+            + std::max(git::objectsSize(m_path) - objectsSize, qint64(0));
+        snapshots.insert(entry);
+        snapshots.updateSizes();
+        if (!snapshots.save())
+            debug::warning("Can't update snapshots catalog");
+        if (!retention::Policy::fromConfig(m_path).isEmpty())
+            prune();
+
+        trees = unitTrees();
+        for (auto it = newFingerprints.begin(); it != newFingerprints.end(); ++it) {
+            auto tree = trees.value(it.key());
+            if (!tree.isEmpty())
+                fingerprints.set(it.key(), it.value() + ':' + tree);
+        }
     } else {
         debug::warning("There is no succeeded units, no tag");
     }
+    fingerprints.save();
     return res;
 }
 
@@ -469,13 +962,15 @@ void Vault::resetMaster()
     m_vcs.checkout("master", CheckoutOptions::Force);
 }
 
-Vault::Result Vault::restore(const QString &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback)
+Vault::Result Vault::restore(const QString &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback
+                             , const progress::Callback &events, const Cancel &cancel)
 {
     Snapshot ss(Gittin::Tag(&m_vcs, QString(">") + snapshot));
-    return restore(ss, home, units, callback);
+    return restore(ss, home, units, callback, events, cancel);
 }
 
-Vault::Result Vault::restore(const Snapshot &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback)
+Vault::Result Vault::restore(const Snapshot &snapshot, const QString &home, const QStringList &units, const ProgressCallback &callback
+                             , const progress::Callback &events, const Cancel &cancel)
 {
     debug::info("Restore units", units, ", home", home);
     Result res;
@@ -490,7 +985,15 @@ Vault::Result Vault::restore(const Snapshot &snapshot, const QString &home, cons
         qDebug() << "Progress" << name << status;
     };
 
-    m_vcs.checkout(snapshot.tag());
+    // unit trees are taken from the snapshot commit directly
+    QHash<QString, QByteArray> trees;
+    for (auto const &e : git::lsTree(m_path, "refs/tags/" + snapshot.tag().name(), false)) {
+        if (e.isTree())
+            trees.insert(e.path, e.sha);
+    }
+    auto scratch = os::path::join(m_path, ".git", "vault.restore");
+    os::rmtree(scratch);
+
     QStringList usedUnits = units;
     if (units.isEmpty()) {
         QMap<QString, config::Unit> units = config().units();
@@ -500,35 +1003,297 @@ Vault::Result Vault::restore(const Snapshot &snapshot, const QString &home, cons
     }
 
     debug::debug("Restore units:", usedUnits);
+    blobs::Storage storage(m_blobStorage);
+    scheduler::Durations durations(absolutePath(fileName(File::Durations)));
+    durations.load();
+    scheduler::Scheduler jobs(git::config(m_path, "vault.jobs", defaultJobs));
+    QMap<QString, std::shared_ptr<Unit> > started;
+    auto scriptOptions = script::Options::fromConfig(m_path);
     for (const QString &unit: usedUnits) {
-        if (restoreUnit(home, unit, progress)) {
+        auto u = std::make_shared<Unit>(unit, home, &m_vcs, config().units().value(unit)
+                                        , &storage);
+        u->m_staging = os::path::join(scratch, unit);
+        u->m_events = events;
+        u->m_script = scriptOptions;
+        u->m_script.cancel = cancel;
+        u->m_script.onProgress = [&jobs, &progress, &events, unit](const QString &status) {
+            jobs.post([&progress, &events, unit, status]() {
+                    scriptProgress(unit, status, progress, events);
+                });
+        };
+        started.insert(unit, u);
+        jobs.add(unit, [u]() { u->importData(); }, durations.get("import/" + unit));
+        auto const &cfg = u->m_config;
+        for (auto const &dependency : cfg.after())
+            jobs.addDependency(unit, dependency);
+        for (auto const &dependent : cfg.before())
+            jobs.addDependency(dependent, unit);
+    }
+    // blobs are materialized in this thread, storage is not thread-safe
+    auto onStart = [&progress, &started, &trees, &cancel](const QString &unit) {
+        debug::info("Restore unit", unit);
+        if (unit.isEmpty())
+            error::raise({{"msg", "Trying to restore unit w/o name"}});
+        cancel.check();
+        progress(unit, "begin");
+        started[unit]->prepareImport(trees.value(unit));
+    };
+    auto onDone = [&](const QString &unit, qint64 elapsed, std::exception_ptr importError) {
+        if (!importError)
+            durations.set("import/" + unit, elapsed);
+        if (restoreUnit(unit, importError, progress)) {
             res.failedUnits.removeOne(unit);
             res.succededUnits << unit;
         }
+        os::rmtree(started[unit]->m_staging);
+        started.remove(unit);
+    };
+    try {
+        jobs.run(onStart, onDone);
+    } catch (...) {
+        storage.release();
+        os::rmtree(scratch);
+        throw;
+    }
+    // materialized blobs can be shared by units, so they are released
+    // when all units are restored
+    storage.release();
+    os::rmtree(scratch);
+    durations.save();
+    return res;
+}
+
+Diff Vault::diff(const Snapshot &from, const Snapshot &to, const QStringList &units)
+{
+    return Diff(new Diff::Data(diff::snapshotTree(m_path, from.tag().name())
+                               , diff::snapshotTree(m_path, to.tag().name()), units));
+}
+
+Diff Vault::diff(const Snapshot &from, const QString &home, const QStringList &units)
+{
+    if (!os::path::isDir(home))
+        error::raise({{"msg", "Home is not a dir"}, {"home", home}});
+    QStringList usedUnits = units;
+    if (units.isEmpty())
+        usedUnits = config().units().keys();
+
+    // units are exported in the same way as during backup, but into
+    // the scratch area removed with the diff
+    auto scratch = os::path::join(m_path, ".git", "vault.diff");
+    os::rmtree(scratch);
+    std::unique_ptr<Diff::Data> res
+        (new Diff::Data(diff::snapshotTree(m_path, from.tag().name())
+                        , diff::dirTree(scratch), usedUnits));
+    res->m_scratch = scratch;
+    auto scriptOptions = script::Options::fromConfig(m_path);
+    for (auto const &name : usedUnits) {
+        Unit unit(name, home, &m_vcs, config().units().value(name), nullptr);
+        unit.m_script = scriptOptions;
+        auto data = os::path::join(scratch, name, "data");
+        auto blobs = os::path::join(scratch, name, "blobs");
+        if (!os::mkdir(data, {{"parent", true}}) || !os::mkdir(blobs))
+            error::raise({{"msg", "Can't create scratch dir"}, {"dir", scratch}});
+        unit.execScript("export", data, blobs);
+    }
+    return Diff(res.release());
+}
+
+int Vault::extract(const Snapshot &snapshot, const QString &unit
+                   , const QStringList &paths, const QString &dst)
+{
+    if (unit.isEmpty())
+        error::raise({{"msg", "Unit name is not supplied"}});
+    QStringList unitPaths;
+    for (auto const &path : paths) {
+        auto p = QDir::cleanPath(path);
+        while (p.startsWith('/'))
+            p.remove(0, 1);
+        if (p.startsWith("..") || p.isEmpty() || p == ".")
+            error::raise({{"msg", "Path should be inside unit tree"}, {"path", path}});
+        unitPaths << os::path::join(unit, p);
+    }
+    if (unitPaths.isEmpty())
+        unitPaths << unit;
+
+    auto treeish = "refs/tags/" + snapshot.tag().name();
+    auto entries = git::lsTree(m_path, treeish, true, false, unitPaths);
+    for (auto const &path : unitPaths) {
+        auto isFound = std::any_of(entries.begin(), entries.end()
+                                   , [&path](git::TreeEntry const &e) {
+                                       return e.path == path || e.path.startsWith(path + "/");
+                                   });
+        if (!isFound)
+            error::raise({{"msg", "No such path in snapshot"}, {"path", path}
+                    , {"snapshot", snapshot.name()}});
     }
 
-    m_vcs.checkout("master");
+    // file contents are streamed from git objects and blob storage,
+    // nothing is checked out or materialized
+    blobs::Storage storage(m_blobStorage);
+    git::ObjectReader objects(m_path);
+    int res = 0;
+    for (auto const &e : entries) {
+        if (e.type != "blob")
+            continue;
+        auto target = os::path::join(dst, e.path.mid(unit.size() + 1));
+        auto dir = os::path::dirName(target);
+        if (!os::path::isDir(dir) && !os::mkdir(dir, {{"parent", true}}))
+            error::raise({{"msg", "Can't create dir"}, {"dir", dir}});
+
+        QByteArray link;
+        if (e.isSymLink()) {
+            QBuffer buf(&link);
+            buf.open(QIODevice::WriteOnly);
+            objects.read(e.sha, buf);
+        }
+        auto sha = link.contains(".git/blobs/")
+            ? blobs::Storage::shaOf(QString::fromUtf8(link)) : QByteArray();
+        if (e.isSymLink() && sha.isEmpty()) {
+            QFile::remove(target);
+            os::symlink(QString::fromUtf8(link), target);
+            ++res;
+            continue;
+        }
+
+        QSaveFile file(target);
+        if (!file.open(QIODevice::WriteOnly))
+            error::raise({{"msg", "Can't create file"}, {"path", target}});
+        QDateTime lastModified;
+        if (sha.isEmpty())
+            objects.read(e.sha, file);
+        else
+            lastModified = storage.read(sha, file);
+        if (!file.commit())
+            error::raise({{"msg", "Can't write file"}, {"path", target}});
+        if (lastModified.isValid())
+            os::setLastModified(target, lastModified);
+        if (e.mode == "100755")
+            QFile::setPermissions(target, QFile::permissions(target)
+                                  | QFile::ExeOwner | QFile::ExeGroup | QFile::ExeOther);
+        ++res;
+    }
+    debug::info("Extracted", res, "files of", unit, "from", snapshot.name());
     return res;
 }
 
+void Vault::resetUnsnapshotted()
+{
+    // master tip is the newest snapshot unless it was removed, then
+    // worktree is returned to the newest remaining snapshot (or to
+    // the initial state) to let gc free blobs of the removed one
+    QByteArray tag;
+    try {
+        tag = git::output(m_path, {"describe", "--tags", "--abbrev=0"
+                    , "--match", ">*", "master"}).trimmed();
+    } catch (error::Error const &) {
+        // no snapshots are left
+        tag = "anchor";
+    }
+    auto changed = git::output(m_path, {"diff", "--name-only"
+                , "refs/tags/" + QString::fromUtf8(tag), "master", "--"});
+    bool isUnitChanged = false;
+    for (auto const &path : changed.split('\n')) {
+        // service files are not referencing blobs
+        if (!path.isEmpty() && !path.startsWith('.'))
+            isUnitChanged = true;
+    }
+    if (!isUnitChanged)
+        return;
+
+    debug::info("Worktree is not a snapshot, reset it to", tag);
+    m_vcs.checkout("master", CheckoutOptions::Force);
+    reset("refs/tags/" + tag);
+    if (getVersion(File::VersionTree) != version::tree) {
+        setVersion(File::VersionTree, version::tree);
+        m_vcs.add(fileName(File::VersionTree));
+        m_vcs.commit("vault format version");
+    }
+}
+
+bool Vault::gc(int budget)
+{
+    resetUnsnapshotted();
+    blobs::Storage storage(m_blobStorage);
+    blobs::Collector collector(m_path, storage);
+    return collector.run(budget);
+}
+
+QStringList Vault::prune(const QVariantMap &policyData)
+{
+    auto policy = policyData.isEmpty()
+        ? retention::Policy::fromConfig(m_path)
+        : retention::Policy::fromMap(policyData);
+    if (policy.isEmpty())
+        return QStringList();
+
+    auto &snapshots = catalog();
+    blobs::Storage storage(m_blobStorage);
+    std::unique_ptr<usage::Accounting> accounting;
+    retention::SizeFn size = nullptr;
+    if (policy.maxSize) {
+        accounting.reset(new usage::Accounting(m_path, storage));
+        size = [&accounting](QList<catalog::Entry> const &kept) {
+            QSet<QByteArray> commits;
+            for (auto const &entry : kept)
+                commits.insert(entry.commit);
+            return accounting->stored(commits);
+        };
+    }
+    auto now = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() / 1000;
+    auto removed = retention::select(snapshots.entries(), policy, now, size);
+    if (removed.isEmpty())
+        return removed;
+
+    debug::info("Prune snapshots", removed);
+    // all tags are deleted in one transaction
+    QByteArray commands;
+    for (auto const &tag : removed)
+        commands += "delete refs/tags/" + tag.toUtf8() + '\n';
+    git::output(m_path, {"update-ref", "--stdin"}, commands);
+
+    for (auto const &tag : removed)
+        snapshots.remove(tag);
+    snapshots.updateSizes();
+    if (!snapshots.save())
+        debug::warning("Can't update snapshots catalog");
+    gc();
+    return removed;
+}
+
+int Vault::pack()
+{
+    blobs::Storage storage(m_blobStorage);
+    return storage.pack(git::config(m_path, "vault.packMaxBlobSize", defaultPackMaxBlobSize)
+                        , git::config(m_path, "vault.packMaxPacks", defaultPackMaxPacks));
+}
+
+catalog::Catalog &Vault::catalog() const
+{
+    if (!m_catalog)
+        m_catalog = std::make_shared<catalog::Catalog>(m_path);
+    m_catalog->refresh();
+    return *m_catalog;
+}
+
 QList<Snapshot> Vault::snapshots() const
 {
-    auto tags = m_vcs.tags();
     QList<Snapshot> list;
-    for (const Gittin::Tag &tag: tags) {
-        if (!tag.name().isEmpty() && tag.name().startsWith('>')) {
-            list << Snapshot(tag);
-        }
-    }
+    for (auto const &entry : catalog().entries())
+        list << Snapshot(Gittin::Tag(&m_vcs, entry.tag), entry.toMap(), m_path);
     return list;
 }
 
 Snapshot Vault::snapshot(const QByteArray &tagName) const
 {
+    auto entry = catalog().find(QString::fromUtf8(tagName));
+    if (entry)
+        return Snapshot(Gittin::Tag(&m_vcs, entry->tag), entry->toMap(), m_path);
+
+    // not a snapshot tag (e.g. obsolete "latest")
     auto tags = m_vcs.tags();
     for (const Gittin::Tag &tag: tags) {
         if (tag.name() == tagName) {
-            return Snapshot(tag);
+            return Snapshot(tag, QVariantMap(), m_path);
         }
     }
     error::raise({{"msg", "Wrong snapshot tag"}, {"tag", tagName}});
@@ -537,6 +1302,9 @@ Snapshot Vault::snapshot(const QByteArray &tagName) const
 
 QString Vault::notes(const QString &snapshot)
 {
+    auto entry = catalog().find(snapshot);
+    if (entry)
+        return entry->message;
     Gittin::Tag tag(&m_vcs, snapshot);
     return tag.notes();
 }
@@ -577,179 +1345,37 @@ bool Vault::setState(const QString &state)
     return writeFile(fileName(File::State), state);
 }
 
-struct Unit
-{
-    Unit(const QString &unit, const QString &home, Gittin::Repo *vcs, const config::Unit &config)
-        : m_home(home)
-        , m_unit(unit)
-        , m_root(QDir(os::path::join(vcs->path(), unit)))
-        , m_vcs(vcs)
-        , m_config(config)
-    {
-        m_blobs = os::path::join(m_root.absolutePath(), "blobs");
-        m_data = os::path::join(m_root.absolutePath(), "data");
-    }
-
-    void execScript(const QString &action)
-    {
-        QString script = m_config.script();
-        debug::info("SCRIPT>>>", script, "action", action);
-        if (!QFileInfo(script).isExecutable()) {
-            error::raise({{"msg", "Should be executable"}, {"script", script}});
-        }
-        QStringList args = { "--action", action,
-                             "--dir", QDir(m_data).absolutePath(),
-                             "--bin-dir", QDir(m_blobs).absolutePath(),
-                             "--home-dir", m_home };
-
-        subprocess::Process ps;
-        ps.start(script, args);
-        ps.wait(-1);
-
-        debug::Level level = ps.rc() ? debug::Level::Error : debug::Level::Info;
-
-        debug::print_ge(level, "RC", ps.rc());
-        debug::print_ge(level, "STDOUT", ps.stdout());
-        debug::print_ge(level, "<<STDOUT");
-        debug::print_ge(level, "STDERR", ps.stderr());
-        debug::print_ge(level, "<<STDERR");
-        debug::print_ge(level, "<<<SCRIPT", script, "action", action, "is done");
-        if (ps.rc()) {
-            QString msg = "Backup script " + script + " exited with rc=" + ps.rc();
-            error::raise({{"msg", msg}, {"stdout", ps.stdout()}, {"stderr", ps.stderr()}});
-        }
-    }
-
-    void linkBlob(const QString &file)
-    {
-        QString blobStorage = os::path::join(m_vcs->path(), ".git", "blobs");
-        QByteArray sha = m_vcs->hashObject(file);
-        QString blobDir = os::path::join(blobStorage, sha.left(2));
-        QString blobFName = os::path::join(blobDir, sha.mid(2));
-        QString linkFName = os::path::join(m_vcs->path(), file);
-
-        if (!os::path::exists(blobDir)) {
-            os::mkdir(blobDir);
-        }
-
-        QDateTime origTime = os::lastModified(linkFName);
-        if (os::path::isFile(blobFName)) {
-            os::unlink(linkFName);
-        } else {
-            os::rename(linkFName, blobFName);
-        }
-        os::setLastModified(blobFName, origTime);
-        QString target = os::path::relative(blobFName, os::path::dirName(linkFName));
-        os::symlink(target, linkFName);
-        if (!os::path::isSymLink(linkFName) && os::path::isFile(blobFName)) {
-            error::raise({{"msg", "Blob should be symlinked"},
-                          {"link", linkFName}, {"target", target}});
-        }
-        m_vcs->add(file);
-    }
-
-    void backup()
-    {
-        QString name = m_config.name();
-
-        // cleanup directories for data and blobs in
-        // the repository
-        os::rmtree(m_blobs);
-        os::rmtree(m_data);
-        os::mkdir(m_root.absolutePath());
-        os::mkdir(m_blobs);
-        os::mkdir(m_data);
-
-        execScript("export");
-
-        Gittin::RepoStatus status = m_vcs->status(os::path::join(m_root.path(), "blobs"));
-        for (const Gittin::RepoStatus::File &file: status.files()) {
-            if (file.index == ' ' && file.workTree == 'D') {
-                m_vcs->rm(file.file);
-                continue;
-            }
-
-            QString fname = QFileInfo(file.file).fileName();
-            QString prefix = config::prefix;
-            if (fname.length() >= prefix.length() && fname.startsWith(prefix)) {
-                m_vcs->add(file.file);
-                continue;
-            }
-
-            linkBlob(file.file);
-        }
-
-        if (m_vcs->status(m_root.path()).isClean()) {
-            debug::info("Nothing to backup for ", name);
-            return;
-        }
-
-        // add all only in data dir to avoid blobs to get into git
-        // objects storage
-        m_vcs->add(os::path::join(m_root.path(), "data"), Gittin::AddOptions::All);
-        status = m_vcs->status(m_root.path());
-        if (status.hasDirtyFiles()) {
-            error::raise({{"msg", "Dirty tree"}, {"dir", m_root.path()}/*, {"status", status_dump(status)}*/});
-        }
-
-        m_vcs->commit(">" + name);
-        status = m_vcs->status(m_root.path());
-        if (!status.isClean()) {
-            error::raise({{"msg", "Not fully commited"}, {"dir", m_root.path()}/*, {"status", status_dump(status)}*/});
-        }
-    }
-
-    void restore()
-    {
-        if (!m_root.exists()) {
-            error::raise({{"reason", "absent"}, {"name", m_unit}});
-        }
-        execScript("import");
-    }
-
-    QString m_home;
-    QString m_unit;
-    QDir m_root;
-    Gittin::Repo *m_vcs;
-    QString m_blobs;
-    QString m_data;
-    config::Unit m_config;
-};
-
-bool Vault::backupUnit(const QString &home, const QString &unit, const ProgressCallback &callback)
+bool Vault::backupUnit(Unit &u, std::exception_ptr exportError, const ProgressCallback &callback)
 {
     Gittin::Commit head = Gittin::Branch(&m_vcs, "master").head();
 
     try {
-        debug::info("Backup unit", unit);
-        if (unit.isEmpty())
-            error::raise({{"msg", "Trying to backup unit w/o name"}});
-
-        callback(unit, "begin");
-        Unit u(unit, home, &m_vcs, config().units().value(unit));
+        if (exportError)
+            std::rethrow_exception(exportError);
+        if (u.m_skipped) {
+            callback(u.m_unit, "unchanged");
+            return true;
+        }
         u.backup();
-        callback(unit, "ok");
+        callback(u.m_unit, "ok");
     } catch (error::Error err) {
         debug::error(err.what(), "\n");
-        callback(unit, err.m.contains("reason") ? err.m.value("reason").toString() : "fail");
-        m_vcs.clean(CleanOptions::Force | CleanOptions::RemoveDirectories | CleanOptions::IgnoreIgnores, unit);
-        m_vcs.reset(ResetOptions::Hard, head.sha());
+        callback(u.m_unit, err.m.contains("reason") ? err.m.value("reason").toString() : "fail");
+        // other units can be still exporting or already staged, so
+        // only this unit is rolled back to the last snapshot
+        git::resetPath(m_path, head.sha(), u.m_unit);
         return false;
     }
 
     return true;
 }
 
-bool Vault::restoreUnit(const QString &home, const QString &unit, const ProgressCallback &callback)
+bool Vault::restoreUnit(const QString &unit, std::exception_ptr importError
+                        , const ProgressCallback &callback)
 {
     try {
-        debug::info("Restore unit", unit);
-        if (unit.isEmpty())
-            error::raise({{"msg", "Trying to restore unit w/o name"}});
-
-        callback(unit, "begin");
-        Unit u(unit, home, &m_vcs, config().units().value(unit));
-        u.restore();
+        if (importError)
+            std::rethrow_exception(importError);
         callback(unit, "ok");
     } catch (error::Error err) {
         debug::error(err.what(), "\n");
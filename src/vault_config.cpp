@@ -79,6 +79,44 @@ QString Unit::script() const
     return m_data.value("script").toString();
 }
 
+// registered from the command line as "name=v1:v2"
+static QStringList toList(QVariant const &v)
+{
+    return v.type() == QVariant::String
+        ? v.toString().split(':', QString::SkipEmptyParts)
+        : v.toStringList();
+}
+
+QStringList Unit::inputs() const
+{
+    return toList(m_data.value("inputs"));
+}
+
+QString Unit::fingerprintCommand() const
+{
+    return m_data.value("fingerprint").toString();
+}
+
+bool Unit::isIncremental() const
+{
+    return m_data.value("incremental", "true").toString() != "false";
+}
+
+int Unit::timeout() const
+{
+    return m_data.value("timeout", 0).toInt();
+}
+
+QStringList Unit::after() const
+{
+    return toList(m_data.value("after"));
+}
+
+QStringList Unit::before() const
+{
+    return toList(m_data.value("before"));
+}
+
 
 
 static Config mkGlobal()
@@ -0,0 +1,133 @@
+/**
+ * @file bench_repo.cpp
+ * @brief Compares git backends on the same staging workload
+ * @author Denis Zalevskiy <denis.zalevskiy@jolla.com>
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * Usage: bench_repo [units [files per unit [rounds]]]
+ *
+ * For each backend fresh repository is created, each round changes
+ * every third file in all units, removes one and adds one, then units
+ * are staged one by one in the same way Vault::backup does it.
+ */
+
+#include <repo.hpp>
+
+#include <qtaround/os.hpp>
+#include <qtaround/subprocess.hpp>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDir>
+
+#include <iostream>
+
+namespace os = qtaround::os;
+namespace subprocess = qtaround::subprocess;
+
+namespace {
+
+void write(QString const &path, QByteArray const &data)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly))
+        qFatal("Can't write %s", qPrintable(path));
+    f.write(data);
+}
+
+QString unitName(int unit)
+{
+    return QString("unit%1").arg(unit);
+}
+
+void prepare(QString const &root, int units, int files)
+{
+    os::rmtree(root);
+    os::mkdir(root, {{"parent", true}});
+    subprocess::Process ps;
+    ps.setWorkingDirectory(root);
+    ps.check_output("git", {"init", "-q"});
+    for (int u = 0; u < units; ++u) {
+        auto dir = os::path::join(root, unitName(u), "data");
+        os::mkdir(dir, {{"parent", true}});
+        for (int i = 0; i < files; ++i)
+            write(os::path::join(dir, QString::number(i)), QByteArray::number(i));
+    }
+}
+
+void modify(QString const &root, int units, int files, int round)
+{
+    for (int u = 0; u < units; ++u) {
+        auto dir = os::path::join(root, unitName(u), "data");
+        for (int i = round % 3; i < files; i += 3)
+            write(os::path::join(dir, QString::number(i))
+                  , QByteArray::number(i) + "/" + QByteArray::number(round));
+        QFile::remove(os::path::join(dir, QString::number(round % files)));
+        write(os::path::join(dir, QString("new%1").arg(round)), "new");
+    }
+}
+
+qint64 stage(vault::repo::Backend &index, QString const &root, int units)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int u = 0; u < units; ++u) {
+        auto unit = os::path::join(root, unitName(u));
+        auto changes = index.status(unit);
+        QStringList paths;
+        for (auto const &c : changes)
+            paths << c.path;
+        index.update(paths);
+        index.addAll(os::path::join(unit, "data"));
+        if (vault::repo::isDirty(index.status(unit)))
+            qFatal("Unit %d is not staged", u);
+    }
+    return timer.elapsed();
+}
+
+void run(vault::repo::Kind kind, QString const &root
+         , int units, int files, int rounds)
+{
+    prepare(root, units, files);
+    auto index = vault::repo::create(root, kind);
+    subprocess::Process ps;
+    ps.setWorkingDirectory(root);
+    qint64 total = 0;
+    for (int r = 0; r <= rounds; ++r) {
+        if (r)
+            modify(root, units, files, r);
+        auto ms = stage(*index, root, units);
+        ps.check_output("git", {"-c", "user.name=bench", "-c", "user.email=bench@localhost"
+                    , "commit", "-q", "-m", QString::number(r)});
+        std::cout << index->name().toStdString() << " round " << r
+                  << ": " << ms << " ms" << std::endl;
+        total += ms;
+    }
+    std::cout << index->name().toStdString() << " total: " << total << " ms" << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+    auto units = args.size() > 1 ? args.at(1).toInt() : 20;
+    auto files = args.size() > 2 ? args.at(2).toInt() : 200;
+    auto rounds = args.size() > 3 ? args.at(3).toInt() : 5;
+    if (units <= 0 || files <= 0 || rounds < 0)
+        qFatal("Usage: bench_repo [units [files per unit [rounds]]]");
+
+    auto root = os::path::join(QDir::tempPath(), "vault-bench-repo");
+    for (auto kind : {vault::repo::Kind::Cli, vault::repo::Kind::LibGit2}) {
+        if (!vault::repo::isAvailable(kind)) {
+            std::cout << "libgit2 backend is not built in" << std::endl;
+            continue;
+        }
+        run(kind, root, units, files, rounds);
+    }
+    os::rmtree(root);
+    return 0;
+}
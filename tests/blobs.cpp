@@ -0,0 +1,467 @@
+#include "vault_context.hpp"
+#include "tests_common.hpp"
+
+#include <hash.hpp>
+#include <blobs.hpp>
+#include <copy.hpp>
+#include <compress.hpp>
+#include <staging.hpp>
+#include <repo.hpp>
+#include <git.hpp>
+
+#include <qtaround/os.hpp>
+#include <qtaround/subprocess.hpp>
+
+#include <tut/tut.hpp>
+
+#include <QDebug>
+#include <QFile>
+#include <QDateTime>
+#include <QFileInfo>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace subprocess = qtaround::subprocess;
+
+namespace tut
+{
+
+struct blobs_test
+{
+    virtual ~blobs_test()
+    {
+    }
+};
+
+typedef test_group<blobs_test> tf;
+typedef tf::object object;
+tf vault_blobs_test("blobs");
+
+enum test_ids {
+    tid_hash = 1
+    , tid_hash_cache
+    , tid_chunked
+    , tid_packs
+    , tid_copy
+    , tid_copy_update
+    , tid_compress
+    , tid_staging
+    , tid_repo
+    , tid_index_batch
+};
+
+namespace {
+
+QString home;
+
+std::function<void ()> setup(test_ids id)
+{
+    reinitContext(QString::number(id));
+    home = str(context["home"]);
+    os::rmtree(home);
+    if (!os::mkdir(home, {{"parent", true}}))
+        error::raise({{"dir", home}, {"msg", "Can't create"}});
+    return []() { os::rmtree(home); };
+}
+
+QByteArray git_hash(QString const &path)
+{
+    subprocess::Process ps;
+    return ps.check_output("git", {"hash-object", path}).trimmed();
+}
+
+QString write_blob(QString const &name, QByteArray const &data)
+{
+    auto path = os::path::join(home, name);
+    QFile f(path);
+    ensure(S_("Can't open", path), f.open(QIODevice::WriteOnly));
+    f.write(data);
+    f.close();
+    ensure(S_("Blob is not written", path), os::path::isFile(path));
+    return path;
+}
+
+} // namespace
+
+template<> template<>
+void object::test<tid_hash>()
+{
+    auto on_exit = setup(tid_hash);
+    QByteArray big;
+    for (int i = 0; i < 100000; ++i)
+        big.append(QByteArray::number(i));
+
+    QStringList paths = {
+        write_blob("empty", "")
+        , write_blob("small", "bin data")
+        , write_blob("big", big)
+    };
+
+    for (auto const &path : paths)
+        ensure_eq(S_("git sha", path), vault::hash::blob(path), git_hash(path));
+
+    auto shas = vault::hash::blobs(paths, 2);
+    ensure_eq("All blobs are hashed", shas.size(), paths.size());
+    for (auto const &path : paths)
+        ensure_eq(S_("parallel sha", path), shas[path], git_hash(path));
+
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_hash_cache>()
+{
+    auto on_exit = setup(tid_hash_cache);
+    auto fname = os::path::join(home, "cache");
+    auto blob = write_blob("b1", "bin data");
+    auto fresh = write_blob("b2", "bin data 2");
+    os::setLastModified(blob, QDateTime::currentDateTime().addDays(-1));
+    auto sha = vault::hash::blob(blob);
+
+    vault::hash::Cache cache(fname);
+    cache.load();
+    cache.put("u/b1", vault::hash::stat(blob), sha);
+    cache.put("u/b2", vault::hash::stat(fresh), vault::hash::blob(fresh));
+    ensure("Cache is saved", cache.save());
+
+    vault::hash::Cache loaded(fname);
+    loaded.load();
+    ensure_eq("Cached sha", loaded.get("u/b1", vault::hash::stat(blob)), sha);
+    ensure("Racy entry is not cached"
+           , loaded.get("u/b2", vault::hash::stat(fresh)).isEmpty());
+
+    os::setLastModified(blob, QDateTime::currentDateTime().addDays(-2));
+    ensure("Changed mtime invalidates entry"
+           , loaded.get("u/b1", vault::hash::stat(blob)).isEmpty());
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_chunked>()
+{
+    auto on_exit = setup(tid_chunked);
+    QByteArray data;
+    quint32 x = 1;
+    for (int i = 0; i < 6 * 1024 * 1024; ++i) {
+        x = x * 1103515245 + 12345;
+        data.append(char(x >> 16));
+    }
+    auto modified = data;
+    modified.insert(3 * 1024 * 1024, "inserted");
+
+    vault::blobs::Storage storage(os::path::join(home, "blobs"));
+    storage.setChunkThreshold(1024 * 1024);
+
+    auto store = [&storage](QString const &path) {
+        auto sha = vault::hash::blob(path);
+        auto dst = storage.add(path, sha);
+        ensure(S_("Source is not removed", path), !os::path::exists(path));
+        ensure(S_("Chunked blob is not stored as file", dst), !os::path::exists(dst));
+        ensure("Manifest exists", os::path::isFile(storage.manifestPath(sha)));
+        return sha;
+    };
+    auto sha1 = store(write_blob("b1", data));
+    auto sha2 = store(write_blob("b2", modified));
+
+    auto m1 = vault::blobs::Manifest::read(storage.manifestPath(sha1));
+    auto m2 = vault::blobs::Manifest::read(storage.manifestPath(sha2));
+    ensure("Several chunks", m1.chunks.size() > 2);
+    QSet<QByteArray> chunks1;
+    for (auto const &c : m1.chunks)
+        chunks1.insert(c.sha);
+    int shared = 0;
+    for (auto const &c : m2.chunks)
+        shared += chunks1.contains(c.sha) ? 1 : 0;
+    ensure("Most chunks are shared", shared >= m2.chunks.size() - 2);
+
+    ensure("Materialized", storage.materialize(sha2));
+    ensure_eq("Reassembled blob", vault::hash::blob(storage.path(sha2)), sha2);
+    storage.release();
+    ensure("Released", !os::path::exists(storage.path(sha2)));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_packs>()
+{
+    auto on_exit = setup(tid_packs);
+    vault::blobs::Storage storage(os::path::join(home, "blobs"));
+    QList<QByteArray> shas;
+    for (auto const &name : QStringList({"b1", "b2", "b3"})) {
+        auto path = write_blob(name, name.toUtf8() + " data");
+        auto sha = vault::hash::blob(path);
+        storage.add(path, sha);
+        shas.push_back(sha);
+    }
+
+    ensure_eq("All blobs are packed", storage.pack(1024, 16), 3);
+    ensure_eq("One pack", storage.packs().size(), 1);
+    for (auto const &sha : shas) {
+        ensure(S_("Loose blob is removed", sha), !os::path::exists(storage.path(sha)));
+        ensure(S_("Packed blob is found", sha), storage.contains(sha));
+    }
+
+    ensure("Materialized from pack", storage.materialize(shas[1]));
+    ensure_eq("Unpacked blob", vault::hash::blob(storage.path(shas[1])), shas[1]);
+    storage.release();
+    ensure("Released", !os::path::exists(storage.path(shas[1])));
+
+    ensure("Dead blob is pruned", storage.prunePacks({shas[0], shas[2]}) > 0);
+    ensure("Live blob is kept", storage.contains(shas[0]));
+    ensure("Dead blob is removed", !storage.contains(shas[1]));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_copy>()
+{
+    auto on_exit = setup(tid_copy);
+    auto src = os::path::join(home, "src");
+    auto dst = os::path::join(home, "dst");
+    ensure("Mkdir", os::mkdir(os::path::join(src, "sub"), {{"parent", true}}));
+    ensure("Mkdir", os::mkdir(dst));
+
+    QByteArray big;
+    for (int i = 0; i < 100000; ++i)
+        big.append(QByteArray::number(i));
+    auto b1 = write_blob("src/b1", big);
+    write_blob("src/sub/b2", "bin data");
+    os::symlink("b1", os::path::join(src, "link"));
+    auto old = QDateTime::currentDateTime().addDays(-1);
+    os::setLastModified(b1, old);
+
+    auto method = vault::copy::file(b1, dst);
+    auto copied = os::path::join(dst, "b1");
+    ensure("Copied", method != vault::copy::Method::Skip);
+    ensure_eq("Same data", vault::hash::blob(copied), vault::hash::blob(b1));
+    ensure_eq("Mtime is preserved", os::lastModified(copied), os::lastModified(b1));
+    ensure("Up to date file is skipped"
+           , vault::copy::file(b1, dst, vault::copy::Update) == vault::copy::Method::Skip);
+
+    vault::copy::tree(src, dst, vault::copy::Preserve);
+    ensure("Subtree", os::path::isFile(os::path::join(dst, "src", "sub", "b2")));
+    ensure("Symlink is kept", os::path::isSymLink(os::path::join(dst, "src", "link")));
+
+    auto contents = os::path::join(home, "contents");
+    ensure("Mkdir", os::mkdir(contents));
+    vault::copy::tree(os::path::join(src, "."), contents
+                      , vault::copy::Preserve | vault::copy::Deref);
+    auto link = os::path::join(contents, "link");
+    ensure("Contents are copied", os::path::isFile(os::path::join(contents, "b1")));
+    ensure("Symlink is dereferenced", !os::path::isSymLink(link) && os::path::isFile(link));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_copy_update>()
+{
+    auto on_exit = setup(tid_copy_update);
+    auto src = os::path::join(home, "src");
+    auto dst = os::path::join(home, "dst");
+    os::mkdir(src);
+    os::mkdir(dst);
+    auto link = os::path::join(src, "link");
+    auto dst_link = os::path::join(dst, "link");
+    auto set_mtime = [](QString const &path, time_t sec) {
+        struct timespec times[2] = {{sec, 0}, {sec, 0}};
+        ::utimensat(AT_FDCWD, QFile::encodeName(path).constData(), times
+                    , AT_SYMLINK_NOFOLLOW);
+    };
+    ensure("Link is created", QFile::link("target1", link));
+    set_mtime(link, 1000);
+    vault::copy::tree(os::path::join(src, "."), dst
+                      , vault::copy::Preserve | vault::copy::Update);
+    ensure_eq("Link is copied", QFileInfo(dst_link).readLink()
+              , os::path::join(dst, "target1"));
+
+    // source is changed later than destination
+    QFile::remove(link);
+    ensure("Link is changed", QFile::link("target2", link));
+    set_mtime(link, 2000);
+    vault::copy::tree(os::path::join(src, "."), dst
+                      , vault::copy::Preserve | vault::copy::Update);
+    ensure_eq("Changed link is restored", QFileInfo(dst_link).readLink()
+              , os::path::join(dst, "target2"));
+
+    // destination is newer
+    QFile::remove(link);
+    ensure("Link is changed", QFile::link("target3", link));
+    set_mtime(link, 1500);
+    vault::copy::tree(os::path::join(src, "."), dst
+                      , vault::copy::Preserve | vault::copy::Update);
+    ensure_eq("Newer link is kept", QFileInfo(dst_link).readLink()
+              , os::path::join(dst, "target2"));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_compress>()
+{
+    auto on_exit = setup(tid_compress);
+    QByteArray text, noise;
+    quint32 x = 1;
+    for (int i = 0; i < 100000; ++i) {
+        text.append("line ").append(QByteArray::number(i % 100)).append('\n');
+        x = x * 1103515245 + 12345;
+        noise.append(char(x >> 16));
+    }
+    auto jpeg = QByteArray("\xff\xd8\xff\xe0", 4) + text;
+
+    ensure("Text is compressible"
+           , vault::compress::isCompressible(write_blob("text", text)));
+    ensure("Noise is not compressible"
+           , !vault::compress::isCompressible(write_blob("noise", noise)));
+    ensure("Jpeg is not compressible"
+           , !vault::compress::isCompressible(write_blob("jpeg", jpeg)));
+    if (!vault::compress::isAvailable()) {
+        on_exit();
+        return;
+    }
+
+    vault::blobs::Storage storage(os::path::join(home, "blobs"));
+    storage.setCompression(3);
+    auto path = write_blob("b1", text);
+    auto sha = vault::hash::blob(path);
+    auto dst = storage.add(path, sha);
+    ensure("Compressed", os::path::isFile(storage.compressedPath(sha)));
+    ensure("No loose blob", !os::path::exists(dst));
+    ensure("Blob is found", storage.contains(sha));
+
+    path = write_blob("b2", noise);
+    auto noiseSha = vault::hash::blob(path);
+    ensure("Noise is stored as is", os::path::isFile(storage.add(path, noiseSha)));
+
+    ensure("Materialized", storage.materialize(sha));
+    ensure_eq("Decompressed blob", vault::hash::blob(dst), sha);
+    storage.release();
+    ensure("Released", !os::path::exists(dst));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_staging>()
+{
+    auto on_exit = setup(tid_staging);
+    auto old = QDateTime::currentDateTime().addDays(-1);
+    vault::blobs::Storage storage(os::path::join(home, "blobs"));
+    vault::hash::Cache cache(os::path::join(home, "cache"));
+
+    // tracked tree
+    ensure("Mkdir", os::mkdir(os::path::join(home, "dst", "bin"), {{"parent", true}}));
+    auto same = write_blob("dst/same", "same data");
+    os::setLastModified(same, old);
+    write_blob("dst/changed", "old data");
+    write_blob("dst/removed", "removed data");
+    auto blob = write_blob("blob", "blob data");
+    auto blobSha = vault::hash::blob(blob);
+    auto stored = storage.add(blob, blobSha);
+    auto link = os::path::join(home, "dst", "bin", "b1");
+    os::symlink(stored, link);
+
+    // exported data
+    ensure("Mkdir", os::mkdir(os::path::join(home, "src", "bin"), {{"parent", true}}));
+    write_blob("src/same", "same data");
+    write_blob("src/changed", "new data");
+    write_blob("src/added", "added data");
+    write_blob("src/bin/b1", "blob data");
+
+    auto stats = vault::staging::sync(os::path::join(home, "src")
+                                      , os::path::join(home, "dst"), "u/data"
+                                      , true, &cache);
+    ensure_eq("Kept", stats.kept, 2);
+    ensure_eq("Updated", stats.updated, 2);
+    ensure_eq("Removed", stats.removed, 1);
+    ensure_eq("Same file is not touched", os::lastModified(same), old);
+    ensure_eq("Changed file is updated"
+              , os::read_file(os::path::join(home, "dst", "changed")), QByteArray("new data"));
+    ensure("Added file", os::path::isFile(os::path::join(home, "dst", "added")));
+    ensure("Removed file", !os::path::exists(os::path::join(home, "dst", "removed")));
+    ensure("Blob symlink is kept", os::path::isSymLink(link));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_repo>()
+{
+    auto on_exit = setup(tid_repo);
+    subprocess::Process ps;
+    ps.setWorkingDirectory(home);
+    ps.check_output("git", {"init", "-q"});
+    ensure("Mkdir", os::mkdir(os::path::join(home, "u", "data"), {{"parent", true}}));
+    write_blob("u/data/f1", "f1");
+    write_blob("u/data/f2", "f2");
+    write_blob("u/.f3", "f3");
+
+    auto index = vault::repo::create(home);
+    auto changes = index->status(os::path::join(home, "u"));
+    ensure_eq("Untracked files", changes.size(), 3);
+    ensure("Untracked is dirty", vault::repo::isDirty(changes));
+
+    index->update({"u/.f3"});
+    index->addAll(os::path::join(home, "u", "data"));
+    changes = index->status(os::path::join(home, "u"));
+    ensure_eq("All are staged", changes.size(), 3);
+    ensure("Staged is not dirty", !vault::repo::isDirty(changes));
+    for (auto const &c : changes)
+        ensure_eq(S_("Added", c.path), c.index, 'A');
+
+    QFile::remove(os::path::join(home, "u", "data", "f1"));
+    QFile::remove(os::path::join(home, "u", ".f3"));
+    index->update({"u/.f3"});
+    index->addAll(os::path::join(home, "u", "data"));
+    changes = index->status(os::path::join(home, "u"));
+    ensure_eq("Removed from index", changes.size(), 1);
+    ensure_eq("Left", changes.at(0).path, QString("u/data/f2"));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_index_batch>()
+{
+    auto on_exit = setup(tid_index_batch);
+    subprocess::Process ps;
+    ps.setWorkingDirectory(home);
+    ps.check_output("git", {"init", "-q"});
+    auto ls_files = []() {
+        subprocess::Process ps;
+        ps.setWorkingDirectory(home);
+        return QString::fromUtf8(ps.check_output("git", {"ls-files", "batch"}))
+        .split('\n', QString::SkipEmptyParts);
+    };
+    ensure("Mkdir", os::mkdir(os::path::join(home, "batch")));
+    write_blob("batch/f1", "1");
+    write_blob("batch/f2", "2");
+
+    vault::git::IndexBatch batch(home);
+    batch.add("batch/f1");
+    batch.add("batch/f2");
+    ensure_eq("Paths are collected", batch.size(), 2);
+    batch.flush();
+    ensure_eq("Batch is flushed", batch.size(), 0);
+    ensure_eq("Files are added", ls_files(), QStringList({"batch/f1", "batch/f2"}));
+
+    QFile::remove(os::path::join(home, "batch", "f1"));
+    write_blob("batch/f3", "3");
+    batch.remove("batch/f1");
+    batch.add("batch/f3");
+    batch.flush();
+    ensure_eq("File is removed", ls_files(), QStringList({"batch/f2", "batch/f3"}));
+
+    ensure("Mkdir", os::mkdir(os::path::join(home, "batch", "dir")));
+    write_blob("batch/dir/f4", "4");
+    batch.add("batch/f2");
+    batch.add("batch/dir");
+    bool is_raised = false;
+    try {
+        batch.flush();
+    } catch (error::Error const &e) {
+        is_raised = true;
+        ensure_eq("Failed path is reported", e.m.value("paths").toStringList()
+                  , QStringList({"batch/dir"}));
+    }
+    ensure("Error is raised", is_raised);
+    on_exit();
+}
+
+}
@@ -25,6 +25,16 @@ Item {
         target: vault
         signalName: "progress"
     }
+    SignalSpy {
+        id: unitsSpy
+        target: vault
+        signalName: "unitsChanged"
+    }
+    SignalSpy {
+        id: snapshotsSpy
+        target: vault
+        signalName: "snapshotsChanged"
+    }
 
     resources: TestCase {
         name: "vault"
@@ -44,13 +54,18 @@ Item {
 
             var unit_script_fname = "unit1_vault";
             vault.registerUnit({name: "unit1", script: "./" + unit_script_fname}, false)
+            // units are read in the background
+            tryCompare(unitsSpy, "count", 1)
             var units = vault.units()
-            verify(units.length == 1)
-            verify('unit1' === units[0]) //Why does "'unit1' in units" fail???
+            verify(units['unit1'] !== undefined)
 
             verify(doneSpy.count == 1)
             vault.startBackup("", ["unit1"])
             tryCompare(doneSpy, "count", 2)
+            // snapshots are re-read after the backup is done
+            tryCompare(snapshotsSpy, "count", 1)
+            compare(vault.snapshots().length, 1)
+            compare(vault.snapshotsModel.count, 1)
         }
     }
 }
@@ -6,15 +6,26 @@
 
 #include <vault/config.hpp>
 #include <vault/vault.hpp>
+#include <scheduler.hpp>
+#include <catalog.hpp>
+#include <retention.hpp>
+#include <script.hpp>
 
 #include <tut/tut.hpp>
 
 //#include "tests_common.hpp"
 
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QRegExp>
+#include <QJsonDocument>
+#include <QFile>
+#include <QFileInfo>
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 
 namespace os = qtaround::os;
@@ -41,7 +52,22 @@ enum test_ids {
     tid_config_update,
     tid_simple_blobs,
     tid_clear,
-    tid_cli_backup_restore_several_units
+    tid_cli_backup_restore_several_units,
+    tid_gc,
+    tid_scheduler,
+    tid_single_commit,
+    tid_incremental,
+    tid_catalog,
+    tid_sizes,
+    tid_retention,
+    tid_restore_worktree,
+    tid_extract,
+    tid_browse,
+    tid_diff,
+    tid_scheduler_deps,
+    tid_script,
+    tid_progress,
+    tid_cancel
 };
 
 namespace {
@@ -305,4 +331,653 @@ void object::test<tid_cli_backup_restore_several_units>()
     on_exit();
 }
 
+template<> template<>
+void object::test<tid_gc>()
+{
+    auto on_exit = setup(tid_gc);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    auto blob_path = [](QString const &name) {
+        auto bin = vlt->unitPath("unit1").bin;
+        return os::path::canonical
+        (os::path::join(bin, "unit1", "binaries", name));
+    };
+
+    do_backup();
+    auto b1_v1 = blob_path("b1");
+    auto b2 = blob_path("b2");
+    ensure(S_("blob is stored", b1_v1), os::path::isFile(b1_v1));
+
+    os::write_file(os::path::join(unit1_dir, "binaries", "b1"), "bin data v2");
+    do_backup();
+    auto b1_v2 = blob_path("b1");
+    ensure("Blob is changed", b1_v1 != b1_v2);
+    ensure_eq("2 snapshots", vlt->snapshots().size(), 2);
+
+    ensure("Nothing to collect", vlt->gc());
+    ensure(S_("Referenced blob is kept", b1_v1), os::path::isFile(b1_v1));
+
+    vlt->snapshots().first().remove();
+    ensure("Incremental gc is not finished w/o budget", !vlt->gc(0));
+    ensure("GC is finished", vlt->gc());
+    ensure(S_("Unreferenced blob is removed", b1_v1), !os::path::exists(b1_v1));
+    ensure(S_("New blob is kept", b1_v2), os::path::isFile(b1_v2));
+    ensure(S_("Shared blob is kept", b2), os::path::isFile(b2));
+
+    os::write_file(os::path::join(unit1_dir, "binaries", "b1"), "bin data v3");
+    do_backup();
+    auto b1_v3 = blob_path("b1");
+    vlt->snapshots().last().remove();
+    ensure("GC after newest is removed", vlt->gc());
+    ensure(S_("Blob of the newest is removed", b1_v3), !os::path::exists(b1_v3));
+    ensure_eq("Worktree is reset to the remaining snapshot", blob_path("b1"), b1_v2);
+
+    vlt->snapshots().last().remove();
+    ensure_eq("No snapshots", vlt->snapshots().size(), 0);
+    ensure("GC after last is removed", vlt->gc());
+    ensure(S_("Blob is removed", b1_v2), !os::path::exists(b1_v2));
+    ensure(S_("Shared blob is removed", b2), !os::path::exists(b2));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_scheduler>()
+{
+    vault::scheduler::Scheduler jobs(2);
+    std::mutex mutex;
+    int running = 0, maxRunning = 0;
+    auto job = [&mutex, &running, &maxRunning]() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            maxRunning = std::max(maxRunning, ++running);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::lock_guard<std::mutex> lock(mutex);
+        --running;
+    };
+    jobs.add("short", job, 1);
+    jobs.add("long", job, 100);
+    jobs.add("failed", []() { error::raise({{"msg", "failed"}}); }, 10);
+    jobs.add("unknown", job);
+
+    QStringList startOrder, doneList, failed;
+    auto callerId = std::this_thread::get_id();
+    jobs.run([&](QString const &name) {
+            ensure("Start is called in the caller thread"
+                   , std::this_thread::get_id() == callerId);
+            startOrder << name;
+        }, [&](QString const &name, qint64, std::exception_ptr error) {
+            ensure("Done is called in the caller thread"
+                   , std::this_thread::get_id() == callerId);
+            doneList << name;
+            if (error)
+                failed << name;
+        });
+    ensure_eq("Longest first", startOrder
+              , QStringList({"long", "failed", "short", "unknown"}));
+    ensure_eq("All are done", doneList.size(), 4);
+    ensure_eq("Error is reported", failed, QStringList({"failed"}));
+    ensure("Limit is respected", maxRunning <= 2);
+}
+
+template<> template<>
+void object::test<tid_single_commit>()
+{
+    auto on_exit = setup(tid_single_commit);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    register_unit(vault_dir, "unit2", false);
+    mktree(unit1_tree, str(get(context, "unit1_dir")));
+    mktree(unit2_tree, str(get(context, "unit2_dir")));
+
+    auto commits_count = []() {
+        Process ps;
+        ps.setWorkingDirectory(vault_dir);
+        return ps.check_output("git", {"rev-list", "--count", "master"})
+        .trimmed().toInt();
+    };
+    auto before = commits_count();
+    do_backup();
+    ensure_eq("Single commit for all units", commits_count(), before + 1);
+
+    auto units = QJsonDocument::fromJson
+        (os::read_file(os::path::join(vault_dir, ".units.json"))).toVariant().toMap();
+    ensure("Unit1 info", units.value("unit1").toMap().value("changed").toBool());
+    ensure("Unit2 info", units.value("unit2").toMap().value("changed").toBool());
+
+    do_backup();
+    units = QJsonDocument::fromJson
+        (os::read_file(os::path::join(vault_dir, ".units.json"))).toVariant().toMap();
+    ensure("Unit1 is not changed", !units.value("unit1").toMap().value("changed").toBool());
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_incremental>()
+{
+    auto on_exit = setup(tid_incremental);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    vault::Vault::execute({{"action", "register"}, {"vault", vault_dir}
+            , {"data", "name=unit1,group=group1,script=./unit1_vault_test"
+                    ",inputs=unit1"}});
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+
+    auto backup = []() {
+        QString res;
+        vlt->backup(home, {}, "", [&res](const QString &, const QString &status) {
+                if (status != "begin")
+                    res = status;
+            });
+        return res;
+    };
+    ensure_eq("First backup", backup(), QString("ok"));
+    ensure_eq("Unit is not changed", backup(), QString("unchanged"));
+    ensure_eq("2 snapshots", vlt->snapshots().size(), 2);
+
+    os::write_file(os::path::join(unit1_dir, "data", "f2"), "data2");
+    ensure_eq("Unit is changed", backup(), QString("ok"));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_catalog>()
+{
+    auto on_exit = setup(tid_catalog);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    mktree(unit1_tree, str(get(context, "unit1_dir")));
+
+    vlt->backup(home, {}, "first");
+    vlt->backup(home, {}, "second");
+    auto fname = os::path::join(vault_dir, ".git", "vault.catalog");
+    ensure("Catalog is created", os::path::isFile(fname));
+    auto snapshots = vlt->snapshots();
+    ensure_eq("2 snapshots", snapshots.size(), 2);
+    auto info = snapshots.last().info();
+    ensure_eq("Message", info.value("message").toString(), QString("second"));
+    ensure("Units", info.value("units").toMap().contains("unit1"));
+    ensure("Duration", info.value("duration").toLongLong() >= 0);
+    ensure_eq("Notes", vlt->notes(snapshots.first().tag().name()), QString("first"));
+    auto timestamp = info.value("timestamp").toLongLong();
+
+    snapshots.first().remove();
+    vault::catalog::Catalog catalog(vault_dir);
+    catalog.refresh();
+    ensure_eq("Removed from catalog", catalog.size(), 1);
+
+    // catalog is rebuilt from git
+    QFile::remove(fname);
+    snapshots = vlt->snapshots();
+    ensure_eq("1 snapshot after rebuild", snapshots.size(), 1);
+    info = snapshots.first().info();
+    ensure_eq("Rebuilt message", info.value("message").toString(), QString("second"));
+    ensure("Rebuilt units", info.value("units").toMap().contains("unit1"));
+    ensure_eq("Same timestamp", info.value("timestamp").toLongLong(), timestamp);
+
+    // tag created outside of vault
+    Process ps;
+    ps.setWorkingDirectory(vault_dir);
+    ps.check_output("git", {"tag", ">external", "master"});
+    ensure_eq("External tag is noticed", vlt->snapshots().size(), 2);
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_sizes>()
+{
+    auto on_exit = setup(tid_sizes);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    do_backup();
+    auto b1_v1 = os::path::canonical
+        (os::path::join(vlt->unitPath("unit1").bin, "unit1", "binaries", "b1"));
+    auto first = vlt->snapshots().first();
+    ensure("Size is calculated", first.size() > 0);
+    ensure("Added bytes", first.addedSize() > 0);
+    auto b2 = os::path::canonical
+        (os::path::join(vlt->unitPath("unit1").bin, "unit1", "binaries", "b2"));
+    ensure_eq("Snapshot owns all blobs", first.uniqueSize()
+              , QFileInfo(b1_v1).size() + QFileInfo(b2).size());
+
+    os::write_file(os::path::join(unit1_dir, "binaries", "b1"), "bin data v2");
+    do_backup();
+    auto snapshots = vlt->snapshots();
+    ensure_eq("2 snapshots", snapshots.size(), 2);
+    ensure_eq("Only old b1 is unique", snapshots.first().uniqueSize()
+              , QFileInfo(b1_v1).size());
+    ensure_eq("Same logical size", snapshots.last().size()
+              , snapshots.first().size() + qint64(QByteArray("bin data v2").size())
+              - QFileInfo(b1_v1).size());
+    auto b1_v2 = os::path::canonical
+        (os::path::join(vlt->unitPath("unit1").bin, "unit1", "binaries", "b1"));
+    ensure_eq("Only new b1 is unique", snapshots.last().uniqueSize()
+              , QFileInfo(b1_v2).size());
+
+    // unique bytes are freed by removal
+    snapshots.last().remove();
+    vlt->gc();
+    ensure(S_("Unique blob is freed", b1_v2), !os::path::exists(b1_v2));
+    ensure(S_("Blob of the remaining snapshot is kept", b1_v1), os::path::isFile(b1_v1));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_retention>()
+{
+    using vault::retention::Policy;
+    const qint64 day = 24 * 60 * 60;
+    // 10 days (starting on thursday) of snapshots made at 00:00 and
+    // 12:00 UTC, now is the noon of the last day
+    const qint64 now = 20 * 7 * day + 9 * day + day / 2;
+    QList<vault::catalog::Entry> entries;
+    for (int i = 0; i < 20; ++i) {
+        vault::catalog::Entry e;
+        e.tag = QString(">s%1").arg(i, 2, 10, QChar('0'));
+        e.timestamp = 20 * 7 * day + i * day / 2;
+        entries.push_back(e);
+    }
+    auto kept = [&entries](QStringList const &removed) {
+        return entries.size() - removed.size();
+    };
+    ensure_eq("Empty policy", vault::retention::select(entries, Policy(), now).size(), 0);
+    Policy last;
+    last.last = 3;
+    auto removed = vault::retention::select(entries, last, now);
+    ensure_eq("Last 3", kept(removed), 3);
+    ensure("Newest is kept", !removed.contains(">s19"));
+    Policy daily;
+    daily.daily = 2;
+    removed = vault::retention::select(entries, daily, now);
+    ensure_eq("Newest of 2 days", kept(removed), 2);
+    ensure("Newest of yesterday is kept", !removed.contains(">s17"));
+    Policy weekly;
+    weekly.weekly = 2;
+    removed = vault::retention::select(entries, weekly, now);
+    ensure_eq("Newest of 2 weeks", kept(removed), 2);
+    Policy size;
+    size.maxSize = 5;
+    removed = vault::retention::select(entries, size, now
+                                       , [](QList<vault::catalog::Entry> const &e) {
+                                           return qint64(e.size());
+                                       });
+    ensure_eq("Fits max size", kept(removed), 5);
+    ensure("Oldest is removed", removed.contains(">s00"));
+
+    auto on_exit = setup(tid_retention);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    do_backup();
+    auto b1_v1 = os::path::canonical
+        (os::path::join(vlt->unitPath("unit1").bin, "unit1", "binaries", "b1"));
+    os::write_file(os::path::join(unit1_dir, "binaries", "b1"), "bin data v2");
+    do_backup();
+    do_backup();
+    ensure_eq("3 snapshots", vlt->snapshots().size(), 3);
+    removed = vlt->prune({{"last", "1"}});
+    ensure_eq("2 snapshots are removed", removed.size(), 2);
+    ensure_eq("1 snapshot left", vlt->snapshots().size(), 1);
+    ensure("Unreferenced blob is collected", !os::path::exists(b1_v1));
+
+    // policy from config is applied after backup
+    Process ps;
+    ps.setWorkingDirectory(vault_dir);
+    ps.check_output("git", {"config", "vault.keepLast", "2"});
+    do_backup();
+    do_backup();
+    ensure_eq("2 snapshots are kept", vlt->snapshots().size(), 2);
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_restore_worktree>()
+{
+    auto on_exit = setup(tid_restore_worktree);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    auto ftree_v1 = get_ftree(unit1_dir);
+    do_backup();
+    auto b1 = os::path::join(unit1_dir, "binaries", "b1");
+    os::write_file(b1, "bin data v2");
+    do_backup();
+
+    auto vault_b1 = os::path::join(vlt->unitPath("unit1").bin, "unit1", "binaries", "b1");
+    auto vault_b1_target = os::path::canonical(vault_b1);
+    os::rmtree(unit1_dir);
+    auto snapshots = vlt->snapshots();
+    ensure_eq("2 snapshots", snapshots.size(), 2);
+    auto res = vlt->restore(snapshots.first(), home, {"unit1"});
+    ensure_eq("Unit is restored", res.succededUnits, QStringList({"unit1"}));
+    ensure_trees_equal("First snapshot is restored", ftree_v1, get_ftree(unit1_dir));
+
+    ensure_eq("Worktree is not touched", os::path::canonical(vault_b1), vault_b1_target);
+    Process ps;
+    ps.setWorkingDirectory(vault_dir);
+    ensure_eq("Master is checked out"
+              , ps.check_output("git", {"symbolic-ref", "HEAD"}).trimmed()
+              , QByteArray("refs/heads/master"));
+    ensure_eq("Unit tree is clean"
+              , ps.check_output("git", {"status", "--porcelain", "--", "unit1"}).trimmed()
+              , QByteArray());
+    ensure("Scratch area is removed"
+           , !os::path::exists(os::path::join(vault_dir, ".git", "vault.restore")));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_extract>()
+{
+    auto on_exit = setup(tid_extract);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    do_backup();
+    os::write_file(os::path::join(unit1_dir, "binaries", "b1"), "bin data v2");
+    do_backup();
+
+    auto dst = os::path::join(home, "extracted");
+    auto first = vlt->snapshots().first();
+    ensure_eq("Single file", vlt->extract(first, "unit1", {"blobs/unit1/binaries/b1"}, dst), 1);
+    auto b1 = os::path::join(dst, "blobs", "unit1", "binaries", "b1");
+    ensure("Blob is extracted as file", os::path::isFile(b1) && !os::path::isSymLink(b1));
+    ensure_eq("Old blob contents", os::read_file(b1), QByteArray("bin data"));
+
+    os::rmtree(dst);
+    ensure_eq("Subtree", vlt->extract(first, "unit1", {"blobs/unit1/binaries"}, dst), 2);
+    ensure_eq("Subtree blob contents"
+              , os::read_file(os::path::join(dst, "blobs", "unit1", "binaries", "b2"))
+              , QByteArray("bin data 2"));
+
+    bool is_raised = false;
+    try {
+        vlt->extract(first, "unit1", {"blobs/absent"}, dst);
+    } catch (error::Error const &) {
+        is_raised = true;
+    }
+    ensure("Absent path is reported", is_raised);
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_browse>()
+{
+    auto on_exit = setup(tid_browse);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    mktree(unit1_tree, str(get(context, "unit1_dir")));
+    do_backup();
+
+    auto snapshot = vlt->snapshots().first();
+    auto root = snapshot.list();
+    auto hasName = [](QList<vault::Snapshot::Entry> const &entries, QString const &name) {
+        return std::any_of(entries.begin(), entries.end()
+                           , [&name](vault::Snapshot::Entry const &e) {
+                               return e.name == name;
+                           });
+    };
+    ensure("Unit dir is listed", hasName(root, "unit1"));
+    auto binaries = snapshot.list("unit1/blobs/unit1/binaries");
+    ensure_eq("2 blobs", binaries.size(), 2);
+    ensure_eq("Sorted by name", binaries.first().name, QString("b1"));
+
+    auto b1 = snapshot.stat("unit1/blobs/unit1/binaries/b1");
+    ensure("Blob link is resolved", b1.isBlob && b1.type == vault::Snapshot::Entry::Type::File);
+    ensure_eq("Blob size", b1.size, qint64(QByteArray("bin data").size()));
+    ensure("Absent path", !snapshot.stat("unit1/absent").isValid());
+    ensure("Dir", snapshot.stat("unit1/blobs").isDir());
+
+    auto file = snapshot.open("unit1/blobs/unit1/binaries/b1");
+    ensure_eq("Blob contents", file->readAll(), QByteArray("bin data"));
+    file = snapshot.open(".units.json");
+    ensure("Git file contents", file->readAll().contains("unit1"));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_diff>()
+{
+    auto on_exit = setup(tid_diff);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    auto unit1_dir = str(get(context, "unit1_dir"));
+    mktree(unit1_tree, unit1_dir);
+    do_backup();
+    auto binaries = os::path::join(unit1_dir, "binaries");
+    os::write_file(os::path::join(binaries, "b1"), "bin data v2");
+    os::rm(os::path::join(binaries, "b2"));
+    os::write_file(os::path::join(binaries, "b3"), "bin data 3");
+    do_backup();
+
+    auto collect = [](vault::Diff &&diff) {
+        QStringList res;
+        vault::Diff::Change change;
+        while (diff.next(change)) {
+            auto type = change.type == vault::Diff::Change::Type::Added ? "A"
+                : change.type == vault::Diff::Change::Type::Removed ? "D" : "M";
+            res << QString("%1 %2/%3").arg(type, change.unit, change.path);
+        }
+        return res;
+    };
+    auto snapshots = vlt->snapshots();
+    ensure_eq("2 snapshots", snapshots.size(), 2);
+    auto changes = collect(vlt->diff(snapshots.first(), snapshots.last()));
+    ensure_eq("Snapshots diff", changes
+              , QStringList({"M unit1/blobs/unit1/binaries/b1"
+                          , "D unit1/blobs/unit1/binaries/b2"
+                          , "A unit1/blobs/unit1/binaries/b3"}));
+    ensure_eq("Same snapshot", collect(vlt->diff(snapshots.last(), snapshots.last())).size(), 0);
+
+    vault::Diff::Change change;
+    auto sizes = vlt->diff(snapshots.first(), snapshots.last());
+    ensure("Has change", sizes.next(change));
+    ensure_eq("Old size", change.oldSize, qint64(QByteArray("bin data").size()));
+    ensure_eq("New size", change.newSize, qint64(QByteArray("bin data v2").size()));
+
+    os::write_file(os::path::join(binaries, "b3"), "bin data 3 v2");
+    changes = collect(vlt->diff(snapshots.last(), home, {"unit1"}));
+    ensure("Home changes", changes.contains("M unit1/blobs/unit1/binaries/b3"));
+    ensure("Unchanged file", !changes.contains("M unit1/blobs/unit1/binaries/b1"));
+    ensure("Scratch area is removed"
+           , !os::path::exists(os::path::join(vault_dir, ".git", "vault.diff")));
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_scheduler_deps>()
+{
+    vault::scheduler::Scheduler jobs(4);
+    std::mutex mutex;
+    QStringList executed;
+    auto job = [&mutex, &executed](QString const &name) {
+        return [&mutex, &executed, name]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::lock_guard<std::mutex> lock(mutex);
+            executed << name;
+        };
+    };
+    jobs.add("contacts", job("contacts"), 100);
+    jobs.add("accounts", job("accounts"));
+    jobs.add("failed", []() { error::raise({{"msg", "failed"}}); });
+    jobs.add("dependent", job("dependent"));
+    jobs.add("indirect", job("indirect"));
+    jobs.add("cycle1", job("cycle1"));
+    jobs.add("cycle2", job("cycle2"));
+    jobs.addDependency("contacts", "accounts");
+    jobs.addDependency("dependent", "failed");
+    jobs.addDependency("indirect", "dependent");
+    jobs.addDependency("cycle1", "cycle2");
+    jobs.addDependency("cycle2", "cycle1");
+    jobs.addDependency("accounts", "absent");
+
+    QStringList doneList, failed, cancelled;
+    jobs.run([](QString const &) {}
+             , [&](QString const &name, qint64, std::exception_ptr error) {
+                 doneList << name;
+                 if (!error)
+                     return;
+                 failed << name;
+                 try {
+                     std::rethrow_exception(error);
+                 } catch (error::Error const &e) {
+                     if (e.m.value("reason").toString() == "cancelled")
+                         cancelled << name;
+                 }
+             });
+    ensure_eq("All are reported", doneList.size(), 7);
+    ensure_eq("Executed", executed, QStringList({"accounts", "contacts"}));
+    failed.sort();
+    ensure_eq("Failed", failed, QStringList({"cycle1", "cycle2", "dependent"
+                    , "failed", "indirect"}));
+    cancelled.sort();
+    ensure_eq("Cancelled", cancelled, QStringList({"cycle1", "cycle2", "dependent"
+                    , "indirect"}));
+}
+
+template<> template<>
+void object::test<tid_script>()
+{
+    using vault::script::RingBuffer;
+    RingBuffer buf(8);
+    buf.append("0123");
+    ensure_eq("Not full", buf.data(), QByteArray("0123"));
+    buf.append("456789");
+    ensure_eq("Tail is kept", buf.data(), QByteArray("23456789"));
+    ensure_eq("Dropped", buf.dropped(), 2);
+    buf.append("abcdefghijk");
+    ensure_eq("Bigger chunk", buf.data(), QByteArray("defghijk"));
+
+    vault::script::Options options;
+    options.outputLimit = 16;
+    QStringList progress;
+    options.onProgress = [&progress](QString const &line) { progress << line; };
+    auto res = vault::script::run("progress", "sh", {"-c"
+                , "echo progress: 1/2; echo 0123456789abcdef0123; echo progress: 2/2; exit 3"}
+        , options);
+    ensure_eq("Script rc", res.rc, 3);
+    ensure("Not timed out", !res.isTimedOut);
+    ensure_eq("Progress", progress, QStringList({"progress: 1/2", "progress: 2/2"}));
+    ensure_eq("Output tail", res.out, QByteArray("3\nprogress: 2/2\n"));
+
+    options.timeout = 200;
+    res = vault::script::run("timeout", "sh", {"-c", "sleep 10"}, options);
+    ensure("Timed out", res.isTimedOut);
+}
+
+template<> template<>
+void object::test<tid_progress>()
+{
+    using namespace vault::progress;
+    QList<Event> events;
+    auto collect = [&events](Event const &e) { events << e; };
+    {
+        Reporter reporter(collect, Phase::Hash, "unit1", 60 * 60 * 1000);
+        reporter.setTotal(1000, 1000 * 10);
+        for (int i = 0; i < 1000; ++i)
+            reporter.add(1, 10);
+        ensure_eq("Reports are coalesced", events.size(), 0);
+        std::thread([&reporter]() { reporter.add(1, 10); }).join();
+        ensure_eq("Not reported from other thread", events.size(), 0);
+        reporter.flush();
+    }
+    ensure_eq("Flushed", events.size(), 1);
+    auto e = events.first();
+    ensure_eq("Files", e.filesDone, 1001);
+    ensure_eq("Bytes", e.bytesDone, 10010);
+    ensure_eq("ETA when done", e.eta, 0);
+
+    Event parsed;
+    ensure("Line is parsed", Event::fromLine(QString::fromUtf8(e.toLine()), parsed));
+    ensure_eq("Phase", name(parsed.phase), QString("hash"));
+    ensure_eq("Unit", parsed.unit, QString("unit1"));
+    ensure_eq("Parsed bytes", parsed.bytesTotal, 10000);
+    ensure("Status is not event", !Event::fromLine("progress: 1/2", parsed));
+
+    auto on_exit = setup(tid_progress);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    mktree(unit1_tree, str(get(context, "unit1_dir")));
+    events.clear();
+    vlt->backup(home, {}, "", nullptr, collect);
+    Event last;
+    bool isExported = false;
+    for (auto const &e : events) {
+        if (e.phase == Phase::Export) {
+            last = e;
+            isExported = true;
+        }
+    }
+    ensure("Unit script reports export", isExported);
+    ensure_eq("Unit name", last.unit, QString("unit1"));
+    ensure("Files are exported", last.filesDone > 0);
+    ensure_eq("All files", last.filesDone, last.filesTotal);
+    on_exit();
+}
+
+template<> template<>
+void object::test<tid_cancel>()
+{
+    vault::script::Options options;
+    QElapsedTimer timer;
+    timer.start();
+    std::thread canceller([options]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            options.cancel.cancel();
+        });
+    auto res = vault::script::run("cancel", "sh", {"-c", "sleep 10"}, options);
+    canceller.join();
+    ensure("Script is cancelled", res.isCancelled);
+    ensure("Cancelled promptly", timer.elapsed() < 5000);
+
+    auto on_exit = setup(tid_cancel);
+    os::rmtree(home);
+    os::mkdir(home);
+    vault_init();
+    register_unit(vault_dir, "unit1", false);
+    mktree(unit1_tree, str(get(context, "unit1_dir")));
+    vault::Cancel cancel;
+    cancel.cancel();
+    QStringList statuses;
+    auto before = vlt->snapshots().size();
+    auto backup = vlt->backup(home, {}, "", [&statuses](const QString &, const QString &status) {
+            statuses << status;
+        }, nullptr, cancel);
+    ensure_eq("Unit is failed", backup.failedUnits, QStringList({"unit1"}));
+    ensure_eq("Unit is cancelled", statuses, QStringList({"cancelled"}));
+    ensure_eq("No snapshot", vlt->snapshots().size(), before);
+    on_exit();
+}
+
 }